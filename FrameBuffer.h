@@ -0,0 +1,1847 @@
+// Capture-side storage of the replay plugin: the frame, audio, packet and
+// texture rings, the spill tier, the shared-memory export, and FrameBuffer on
+// top of them. It is shared by the plugin and the benchmark. Each is one
+// translation unit that includes this once and defines plugin_enabled and
+// request_memory_reclaim().
+#pragma once
+
+#include <obs.h>
+#include <util/platform.h>
+
+#include <memory>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <atomic>
+#include <cstring>
+#include <algorithm>
+#include <cstdint>
+#include <cerrno>
+#include <cstddef>
+#include <new>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+extern std::atomic<bool> plugin_enabled;
+
+// What the capture paths do per frame. They only bump a counter; the log
+// worker turns the counts into one summary line per interval.
+enum class CaptureEvent {
+	VideoFrame,    // Raw frame copied into a ring
+	VideoSkipped,  // Raw frame with nowhere to go
+	VideoRejected, // Null or zero-sized frame, or one in a layout the target is not set up for
+	SlotFailure,   // No memory or texture for a frame
+	TextureFrame,
+	AudioChunk,
+	Packet,
+	VideoEvicted, // Raw frame aged out or reclaimed for the memory budget
+	VideoThinned, // Frame left out by a capture profile's frame interval
+	Count,
+};
+static std::atomic<uint64_t> capture_events[(size_t)CaptureEvent::Count];
+
+static inline void count_capture_event(CaptureEvent event, uint64_t count = 1)
+{
+	capture_events[(size_t)event].fetch_add(count, std::memory_order_relaxed);
+}
+
+// Latency distribution in quarter-octave buckets, so a percentile is within
+// a quarter of the true value. record() is a few relaxed atomic adds and
+// never locks, so it is safe on the capture threads.
+struct LatencyHistogram {
+	static const size_t sub_buckets = 4;
+	static const size_t bucket_count = 64 * sub_buckets;
+
+	std::atomic<uint64_t> buckets[bucket_count];
+	std::atomic<uint64_t> count{0};
+	std::atomic<uint64_t> total_ns{0};
+	std::atomic<uint64_t> max_ns{0};
+
+	LatencyHistogram()
+	{
+		for (auto &bucket : buckets)
+			bucket.store(0, std::memory_order_relaxed);
+	}
+
+	static size_t get_bucket(uint64_t ns)
+	{
+		if (ns < sub_buckets)
+			return (size_t)ns;
+		size_t msb = 0;
+		for (uint64_t v = ns; v >>= 1;)
+			msb++;
+		return (msb - 1) * sub_buckets + (size_t)((ns >> (msb - 2)) & (sub_buckets - 1));
+	}
+
+	// Largest value that falls in a bucket
+	static uint64_t get_bucket_limit(size_t bucket)
+	{
+		if (bucket < sub_buckets)
+			return bucket;
+		size_t msb = bucket / sub_buckets + 1;
+		uint64_t width = 1ULL << (msb - 2);
+		return (sub_buckets + bucket % sub_buckets) * width + width - 1;
+	}
+
+	void record(uint64_t ns)
+	{
+		buckets[get_bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+		count.fetch_add(1, std::memory_order_relaxed);
+		total_ns.fetch_add(ns, std::memory_order_relaxed);
+		uint64_t max = max_ns.load(std::memory_order_relaxed);
+		while (ns > max && !max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+			;
+	}
+
+	// Value at or below which `fraction` of the samples fall, rounded up to
+	// its bucket. 0 with no samples.
+	uint64_t percentile(double fraction) const
+	{
+		uint64_t counts[bucket_count];
+		uint64_t samples = 0;
+		for (size_t i = 0; i < bucket_count; i++) {
+			counts[i] = buckets[i].load(std::memory_order_relaxed);
+			samples += counts[i];
+		}
+		if (samples == 0)
+			return 0;
+
+		uint64_t wanted = std::max<uint64_t>(1, (uint64_t)(fraction * (double)samples + 0.5));
+		uint64_t seen = 0;
+		for (size_t i = 0; i < bucket_count; i++) {
+			seen += counts[i];
+			if (seen >= wanted)
+				return std::min(get_bucket_limit(i), max_ns.load(std::memory_order_relaxed));
+		}
+		return max_ns.load(std::memory_order_relaxed);
+	}
+};
+
+// Telemetry for GetReplayStats, kept since the plugin loaded
+struct ReplayStats {
+	LatencyHistogram raw_video;        // raw_video_callback
+	LatencyHistogram texture_video;    // texture_rendered_callback
+	LatencyHistogram filter_video;     // replay_filter_video
+	LatencyHistogram audio;            // Mix and filter audio callbacks
+	LatencyHistogram playback_render;  // Replay source renders while a replay plays
+	LatencyHistogram save;             // One whole save, encode or remux
+	LatencyHistogram map_lock_wait;    // Waits on buffer_mutex
+	LatencyHistogram buffer_lock_wait; // Capture waits on a buffer's own lock
+
+	// Export throughput, counted on success
+	std::atomic<uint64_t> saves{0};
+	std::atomic<uint64_t> saved_frames{0};
+	std::atomic<uint64_t> saved_bytes{0}; // Buffered bytes read, not file size
+	std::atomic<uint64_t> save_ns{0};
+};
+static ReplayStats replay_stats;
+
+// Records the lifetime of a scope into a histogram
+struct ScopedLatency {
+	LatencyHistogram &histogram;
+	uint64_t start;
+
+	explicit ScopedLatency(LatencyHistogram &target) : histogram(target), start(os_gettime_ns()) {}
+	~ScopedLatency() { histogram.record(os_gettime_ns() - start); }
+
+	uint64_t elapsed() const { return os_gettime_ns() - start; }
+};
+
+// Lock that records how long it waited. An uncontended lock counts as a
+// zero wait without reading the clock.
+struct TimedLock {
+	std::unique_lock<std::mutex> lock;
+
+	TimedLock(std::mutex &mutex, LatencyHistogram &waits) : lock(mutex, std::try_to_lock)
+	{
+		if (lock.owns_lock()) {
+			waits.record(0);
+			return;
+		}
+		uint64_t start = os_gettime_ns();
+		lock.lock();
+		waits.record(os_gettime_ns() - start);
+	}
+};
+
+// Hold a reference to an encoder packet for as long as the shared_ptr lives
+static std::shared_ptr<encoder_packet> make_packet_ref(struct encoder_packet *packet)
+{
+	auto *ref = new encoder_packet();
+	obs_encoder_packet_ref(ref, packet);
+	return std::shared_ptr<encoder_packet>(ref, [](encoder_packet *p) {
+		obs_encoder_packet_release(p);
+		delete p;
+	});
+}
+
+// Plane geometry of a raw video format. A plane's rows hold its width,
+// after subsampling, in blocks of `block_pixels` pixels and `block_bytes`
+// bytes: one pixel for planar formats, a macropixel for packed 4:2:2 and a
+// 48-pixel group for v210.
+struct PlaneFormat {
+	size_t planes = 0;
+	uint32_t block_pixels[MAX_AV_PLANES] = {};
+	uint32_t block_bytes[MAX_AV_PLANES] = {};
+	uint32_t width_shift[MAX_AV_PLANES] = {};
+	uint32_t height_shift[MAX_AV_PLANES] = {};
+
+	// Bytes of one row without padding
+	size_t row_bytes(size_t plane, uint32_t width) const {
+		uint32_t plane_width = (width + (1u << width_shift[plane]) - 1) >> width_shift[plane];
+		return (size_t)((plane_width + block_pixels[plane] - 1) / block_pixels[plane]) * block_bytes[plane];
+	}
+
+	uint32_t rows(size_t plane, uint32_t height) const {
+		return (height + (1u << height_shift[plane]) - 1) >> height_shift[plane];
+	}
+};
+
+// A single packed plane
+static PlaneFormat make_packed_format(uint32_t block_pixels, uint32_t block_bytes)
+{
+	PlaneFormat layout;
+	layout.planes = 1;
+	layout.block_pixels[0] = block_pixels;
+	layout.block_bytes[0] = block_bytes;
+	return layout;
+}
+
+// Luma, then chroma subsampled by the shifts: two planes, or one interleaved
+// plane when `semi_planar`. A fourth plane is full-size alpha.
+static PlaneFormat make_yuv_format(size_t planes, uint32_t sample_bytes, uint32_t width_shift, uint32_t height_shift,
+				   bool semi_planar = false)
+{
+	PlaneFormat layout;
+	layout.planes = planes;
+	for (size_t i = 0; i < planes; i++) {
+		bool chroma = i == 1 || (i == 2 && !semi_planar);
+		layout.block_pixels[i] = 1;
+		layout.block_bytes[i] = (semi_planar && i == 1) ? sample_bytes * 2 : sample_bytes;
+		layout.width_shift[i] = chroma ? width_shift : 0;
+		layout.height_shift[i] = chroma ? height_shift : 0;
+	}
+	return layout;
+}
+
+static bool get_plane_format(enum video_format format, PlaneFormat &layout)
+{
+	switch (format) {
+	case VIDEO_FORMAT_I420: layout = make_yuv_format(3, 1, 1, 1); return true;
+	case VIDEO_FORMAT_I40A: layout = make_yuv_format(4, 1, 1, 1); return true;
+	case VIDEO_FORMAT_NV12: layout = make_yuv_format(2, 1, 1, 1, true); return true;
+	case VIDEO_FORMAT_I010: layout = make_yuv_format(3, 2, 1, 1); return true;
+	case VIDEO_FORMAT_P010: layout = make_yuv_format(2, 2, 1, 1, true); return true;
+	case VIDEO_FORMAT_I422: layout = make_yuv_format(3, 1, 1, 0); return true;
+	case VIDEO_FORMAT_I42A: layout = make_yuv_format(4, 1, 1, 0); return true;
+	case VIDEO_FORMAT_I210: layout = make_yuv_format(3, 2, 1, 0); return true;
+	case VIDEO_FORMAT_P216: layout = make_yuv_format(2, 2, 1, 0, true); return true;
+	case VIDEO_FORMAT_I444: layout = make_yuv_format(3, 1, 0, 0); return true;
+	case VIDEO_FORMAT_YUVA: layout = make_yuv_format(4, 1, 0, 0); return true;
+	case VIDEO_FORMAT_I412: layout = make_yuv_format(3, 2, 0, 0); return true;
+	case VIDEO_FORMAT_YA2L: layout = make_yuv_format(4, 2, 0, 0); return true;
+	case VIDEO_FORMAT_P416: layout = make_yuv_format(2, 2, 0, 0, true); return true;
+	case VIDEO_FORMAT_YVYU:
+	case VIDEO_FORMAT_YUY2:
+	case VIDEO_FORMAT_UYVY: layout = make_packed_format(2, 4); return true;
+	case VIDEO_FORMAT_V210: layout = make_packed_format(48, 128); return true;
+	case VIDEO_FORMAT_Y800: layout = make_packed_format(1, 1); return true;
+	case VIDEO_FORMAT_BGR3: layout = make_packed_format(1, 3); return true;
+	case VIDEO_FORMAT_RGBA:
+	case VIDEO_FORMAT_BGRA:
+	case VIDEO_FORMAT_BGRX:
+	case VIDEO_FORMAT_AYUV:
+	case VIDEO_FORMAT_R10L: layout = make_packed_format(1, 4); return true;
+	default:
+		layout = PlaneFormat();
+		return false;
+	}
+}
+
+// Planes start on cache lines within a slot
+static size_t align_plane_size(size_t size)
+{
+	return (size + 63) & ~(size_t)63;
+}
+
+// Copies at least this large bypass the cache. The slot is not read again
+// until playback or export, so caching it only evicts the video thread's
+// working set.
+static constexpr size_t STREAMING_COPY_MIN_BYTES = 64 * 1024;
+
+static void copy_bytes_streaming(uint8_t *dst, const uint8_t *src, size_t size)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+	size_t head = std::min(size, (size_t)(-(uintptr_t)dst & 15));
+	std::memcpy(dst, src, head);
+	dst += head;
+	src += head;
+	size -= head;
+
+	for (; size >= 64; size -= 64, dst += 64, src += 64) {
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16));
+		__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 32));
+		__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 48));
+		_mm_stream_si128(reinterpret_cast<__m128i *>(dst), a);
+		_mm_stream_si128(reinterpret_cast<__m128i *>(dst + 16), b);
+		_mm_stream_si128(reinterpret_cast<__m128i *>(dst + 32), c);
+		_mm_stream_si128(reinterpret_cast<__m128i *>(dst + 48), d);
+	}
+#endif
+	std::memcpy(dst, src, size);
+}
+
+static void copy_bytes(uint8_t *dst, const uint8_t *src, size_t size, bool streaming)
+{
+	if (streaming)
+		copy_bytes_streaming(dst, src, size);
+	else
+		std::memcpy(dst, src, size);
+}
+
+// Copy a plane into packed storage, dropping the source's row padding
+static void copy_plane(uint8_t *dst, const uint8_t *src, size_t src_linesize, size_t row_bytes, size_t rows)
+{
+	bool streaming = row_bytes * rows >= STREAMING_COPY_MIN_BYTES;
+	if (src_linesize == row_bytes) {
+		copy_bytes(dst, src, row_bytes * rows, streaming);
+		return;
+	}
+	for (size_t y = 0; y < rows; y++, dst += row_bytes, src += src_linesize)
+		copy_bytes(dst, src, row_bytes, streaming);
+}
+
+// Order streaming stores before the slot is published to other threads
+static void finish_streaming_copy()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+	_mm_sfence();
+#endif
+}
+
+// Pre-allocated frame slot. All planes live in one contiguous block that is
+// reused for every frame written into the slot.
+struct VideoSlot {
+	obs_source_frame frame = {};
+	uint8_t *storage = nullptr;
+	size_t capacity = 0;
+	size_t size = 0; // Bytes the current frame uses
+	// Size before a capture profile scaled the frame; playback draws at it
+	uint32_t display_width = 0;
+	uint32_t display_height = 0;
+
+	VideoSlot() = default;
+	VideoSlot(const VideoSlot &) = delete;
+	VideoSlot &operator=(const VideoSlot &) = delete;
+
+	~VideoSlot() {
+		bfree(storage);
+	}
+
+	bool reserve(size_t size) {
+		if (capacity >= size)
+			return true;
+		bfree(storage);
+		storage = static_cast<uint8_t *>(bmalloc(size));
+		capacity = storage ? size : 0;
+		return storage != nullptr;
+	}
+};
+
+// Fixed run of consecutive entries. Entries below `count` never change once
+// written, so snapshots share whole segments instead of copying frames.
+template<typename T> struct Segment {
+	std::vector<T> entries;
+	size_t count = 0;
+	std::shared_ptr<const void> backing; // Set when entry data lives outside the slots
+
+	explicit Segment(size_t capacity) : entries(capacity) {}
+};
+
+// Pinned, immutable view over a range of segment entries. Holding the view
+// keeps its segments out of the writer's recycling.
+template<typename T> struct SegmentView {
+	std::vector<std::shared_ptr<const Segment<T>>> segments;
+	size_t capacity = 0; // Entries per segment
+	size_t first = 0;    // Offset of the first entry in segments.front()
+	size_t count = 0;
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	const T &operator[](size_t i) const {
+		size_t pos = first + i;
+		return segments[pos / capacity]->entries[pos % capacity];
+	}
+
+	// Entries [begin, end) of this view, pinning only the segments they use
+	SegmentView slice(size_t begin, size_t end) const {
+		SegmentView result;
+		result.capacity = capacity;
+		end = std::min(end, count);
+		begin = std::min(begin, end);
+		result.count = end - begin;
+		if (result.count == 0)
+			return result;
+
+		size_t first_segment = (first + begin) / capacity;
+		size_t last_segment = (first + end - 1) / capacity;
+		result.first = (first + begin) % capacity;
+		result.segments.assign(segments.begin() + first_segment, segments.begin() + last_segment + 1);
+		return result;
+	}
+};
+
+// First index in a timestamp-ordered sequence whose timestamp is at or
+// after `timestamp`
+template<typename TimestampAt> static size_t seek_timestamp(size_t count, uint64_t timestamp, TimestampAt timestamp_at)
+{
+	size_t low = 0;
+	size_t high = count;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (timestamp_at(mid) < timestamp)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+// Ring of fixed-size segments. The oldest segment is evicted whole once the
+// rest still holds max_entries, and is reused as the next open segment unless
+// a snapshot still pins it. The owner provides locking.
+template<typename T> struct SegmentRing {
+	std::deque<std::shared_ptr<Segment<T>>> segments;
+	std::shared_ptr<Segment<T>> spare;
+	size_t capacity = 0;
+	size_t max_entries = 0;
+	size_t total = 0;
+
+	void reset(size_t segment_capacity, size_t max) {
+		segments.clear();
+		spare.reset();
+		capacity = segment_capacity;
+		max_entries = max;
+		total = 0;
+	}
+
+	// Drop the oldest segment, keeping it as the spare. The open segment is
+	// never dropped.
+	std::shared_ptr<const Segment<T>> evict_oldest() {
+		if (segments.size() <= 1)
+			return nullptr;
+		total -= segments.front()->count;
+		std::shared_ptr<Segment<T>> evicted = std::move(segments.front());
+		segments.pop_front();
+		retire(evicted);
+		return evicted;
+	}
+
+	// Swap a closed segment for one holding the same entries elsewhere.
+	// Returns false if the segment has already left the ring.
+	bool replace(const std::shared_ptr<Segment<T>> &segment, std::shared_ptr<Segment<T>> replacement) {
+		auto it = std::find(segments.begin(), segments.end(), segment);
+		if (it == segments.end() || std::next(it) == segments.end())
+			return false;
+		*it = std::move(replacement);
+		retire(segment);
+		return true;
+	}
+
+	// Keep a segment that left the ring for reuse. Backed segments have no
+	// slot storage worth keeping.
+	void retire(const std::shared_ptr<Segment<T>> &segment) {
+		if (!segment->backing)
+			spare = segment;
+	}
+
+	// Entry to fill for the next write; commit() publishes it
+	T *next_entry() {
+		if (capacity == 0)
+			return nullptr;
+
+		if (segments.empty() || segments.back()->count == capacity) {
+			std::shared_ptr<Segment<T>> segment;
+			if (spare && spare.use_count() == 1) {
+				segment = std::move(spare);
+				segment->count = 0;
+			} else {
+				segment = std::make_shared<Segment<T>>(capacity);
+			}
+			spare.reset();
+			segments.push_back(std::move(segment));
+		}
+
+		Segment<T> &open = *segments.back();
+		return &open.entries[open.count];
+	}
+
+	// Give up on the entry from next_entry(). A segment it opened goes back
+	// to being the spare, so no empty segment is left in the ring.
+	void cancel_entry() {
+		if (segments.empty() || segments.back()->count != 0)
+			return;
+		std::shared_ptr<Segment<T>> segment = std::move(segments.back());
+		segments.pop_back();
+		retire(segment);
+	}
+
+	// Returns true if a segment was evicted
+	bool commit() {
+		segments.back()->count++;
+		total++;
+
+		bool evicted = false;
+		while (segments.size() > 1 && total - segments.front()->count >= max_entries) {
+			total -= segments.front()->count;
+			retire(segments.front());
+			segments.pop_front();
+			evicted = true;
+		}
+		return evicted;
+	}
+
+	// The newest `count` entries (all of them by default)
+	SegmentView<T> view(size_t count = SIZE_MAX) const {
+		SegmentView<T> result;
+		result.capacity = capacity;
+		result.count = std::min(count, total);
+		if (result.count == 0)
+			return result;
+
+		size_t skip = total - result.count;
+		size_t first_segment = skip / capacity;
+		result.first = skip % capacity;
+		for (size_t i = first_segment; i < segments.size(); i++) {
+			result.segments.push_back(segments[i]);
+		}
+		return result;
+	}
+};
+
+using VideoView = SegmentView<VideoSlot>;
+
+// Extents start on this boundary, which satisfies both the page size and the
+// Windows allocation granularity for mapping offsets
+static const uint64_t SPILL_ALIGNMENT = 64 * 1024;
+
+static std::atomic<uint64_t> next_spill_file_id{0};
+
+// Writable mapping of one extent of a spill file. Unmapped when the last
+// segment or snapshot using it lets go.
+struct SpillMapping {
+	void *base = nullptr;
+	size_t length = 0;
+
+	uint8_t *data() const { return static_cast<uint8_t *>(base); }
+
+	~SpillMapping() {
+#ifdef _WIN32
+		if (base)
+			UnmapViewOfFile(base);
+#else
+		if (base)
+			munmap(base, length);
+#endif
+	}
+};
+
+// Append-only file of spilled video segments, reused as a ring: the head
+// wraps to the start of the file once the oldest extents there have been
+// unmapped. The file is removed by the OS when it is closed.
+struct SpillFile {
+	// Timestamp to offset index of the spilled segments, oldest first
+	struct Extent {
+		uint64_t timestamp = 0; // First frame in the extent
+		uint64_t offset = 0;
+		uint64_t length = 0;
+		std::weak_ptr<SpillMapping> mapping;
+	};
+	std::deque<Extent> extents;
+	uint64_t file_size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+#else
+	int fd = -1;
+#endif
+
+	SpillFile() = default;
+	SpillFile(const SpillFile &) = delete;
+	SpillFile &operator=(const SpillFile &) = delete;
+
+	~SpillFile() {
+#ifdef _WIN32
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+#else
+		if (fd >= 0)
+			close(fd);
+#endif
+	}
+
+	static std::unique_ptr<SpillFile> open(const std::string &directory) {
+		if (os_mkdirs(directory.c_str()) == MKDIR_ERROR) {
+			blog(LOG_ERROR, "Failed to create spill directory: %s", directory.c_str());
+			return nullptr;
+		}
+
+		std::filesystem::path path = std::filesystem::u8path(directory) /
+					     ("replay-spill-" + std::to_string(next_spill_file_id++) + ".bin");
+		auto spill = std::make_unique<SpillFile>();
+#ifdef _WIN32
+		spill->file = CreateFileW(path.wstring().c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+					  FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+		if (spill->file == INVALID_HANDLE_VALUE) {
+#else
+		spill->fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+		if (spill->fd >= 0)
+			unlink(path.c_str()); // Gone once closed, even after a crash
+		if (spill->fd < 0) {
+#endif
+			blog(LOG_ERROR, "Failed to create spill file: %s", path.u8string().c_str());
+			return nullptr;
+		}
+		return spill;
+	}
+
+	// Map room for `size` bytes behind the newest extent. Returns nullptr if
+	// the extents still in use leave no gap that large.
+	std::shared_ptr<SpillMapping> allocate(size_t size, uint64_t timestamp) {
+		uint64_t length = (size + SPILL_ALIGNMENT - 1) / SPILL_ALIGNMENT * SPILL_ALIGNMENT;
+
+		// Extents are released roughly in the order they were written
+		while (!extents.empty() && extents.front().mapping.expired())
+			extents.pop_front();
+
+		uint64_t offset = 0;
+		if (!extents.empty()) {
+			const Extent &oldest = extents.front();
+			const Extent &newest = extents.back();
+			uint64_t head = newest.offset + newest.length;
+			bool wrapped = newest.offset < oldest.offset;
+			if (!wrapped && oldest.offset >= length)
+				offset = 0;
+			else if (!wrapped || head + length <= oldest.offset)
+				offset = head;
+			else
+				return nullptr;
+		}
+
+		if (offset + length > file_size && !resize(offset + length))
+			return nullptr;
+
+		auto mapping = std::make_shared<SpillMapping>();
+		mapping->length = (size_t)length;
+#ifdef _WIN32
+		uint64_t end = offset + length;
+		HANDLE section = CreateFileMappingW(file, nullptr, PAGE_READWRITE, (DWORD)(end >> 32), (DWORD)end, nullptr);
+		if (section) {
+			mapping->base = MapViewOfFile(section, FILE_MAP_WRITE, (DWORD)(offset >> 32), (DWORD)offset,
+						      (SIZE_T)length);
+			CloseHandle(section); // The view keeps the section alive
+		}
+#else
+		void *base = mmap(nullptr, (size_t)length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t)offset);
+		mapping->base = base == MAP_FAILED ? nullptr : base;
+#endif
+		if (!mapping->base) {
+			blog(LOG_ERROR, "Failed to map %llu bytes of the spill file", (unsigned long long)length);
+			return nullptr;
+		}
+
+		Extent extent;
+		extent.timestamp = timestamp;
+		extent.offset = offset;
+		extent.length = length;
+		extent.mapping = mapping;
+		extents.push_back(extent);
+		return mapping;
+	}
+
+private:
+	bool resize(uint64_t size) {
+#ifdef _WIN32
+		LARGE_INTEGER end;
+		end.QuadPart = (LONGLONG)size;
+		bool resized = SetFilePointerEx(file, end, nullptr, FILE_BEGIN) && SetEndOfFile(file);
+#else
+		bool resized = ftruncate(fd, (off_t)size) == 0;
+#endif
+		if (!resized) {
+			blog(LOG_ERROR, "Failed to grow the spill file to %llu bytes", (unsigned long long)size);
+			return false;
+		}
+		file_size = size;
+		return true;
+	}
+};
+
+// Shared-memory export: a named ring that mirrors a buffer's newest raw
+// frames for external processes. The layout is fixed so readers need no
+// headers from this plugin:
+//   SharedRingHeader at offset 0
+//   slot_count slots of slot_size bytes from slots_offset, each
+//   SharedSlotHeader followed, at SHARED_SLOT_DATA_OFFSET, by packed planes
+// A slot's sequence is odd while the writer fills it and even when done.
+// Readers take the newest slot from write_cursor, read the slot in place and
+// keep it only if the sequence was even and unchanged around the read.
+static const char SHARED_RING_MAGIC[8] = {'O', 'B', 'S', 'R', 'P', 'L', 'Y', '\0'};
+static const uint32_t SHARED_RING_VERSION = 1;
+static const size_t SHARED_RING_HEADER_SIZE = 256;
+static const size_t SHARED_SLOT_DATA_OFFSET = 256;
+
+struct SharedRingHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t slot_count;
+	uint64_t slot_size;    // Bytes per slot, its header included
+	uint64_t slots_offset; // Of the first slot, from the start of the mapping
+	std::atomic<uint64_t> write_cursor; // Frames published; the newest is in slot (cursor - 1) % slot_count
+	std::atomic<uint64_t> dropped;      // Frames too large for a slot
+	std::atomic<uint32_t> closed;       // Set when the writer goes away
+};
+
+struct SharedSlotHeader {
+	std::atomic<uint64_t> sequence;
+	uint64_t frame_index; // Write cursor the frame was published at
+	uint64_t timestamp;   // Capture time, os_gettime_ns()
+	uint32_t width;
+	uint32_t height;
+	uint32_t display_width; // Before a capture profile scaled it
+	uint32_t display_height;
+	uint32_t format; // enum video_format
+	uint32_t full_range;
+	uint32_t data_size;
+	uint32_t offsets[MAX_AV_PLANES]; // Of each plane, from the slot data
+	uint32_t linesize[MAX_AV_PLANES];
+	float color_matrix[16];
+	float color_range_min[3];
+	float color_range_max[3];
+};
+
+// Readers depend on these offsets
+static_assert(sizeof(SharedRingHeader) <= SHARED_RING_HEADER_SIZE, "shared ring header outgrew its space");
+static_assert(sizeof(SharedSlotHeader) <= SHARED_SLOT_DATA_OFFSET, "shared slot header outgrew its space");
+static_assert(offsetof(SharedRingHeader, write_cursor) == 32 && offsetof(SharedRingHeader, closed) == 48,
+	      "shared ring header layout changed");
+static_assert(offsetof(SharedSlotHeader, offsets) == 52 && offsetof(SharedSlotHeader, color_range_max) == 192,
+	      "shared slot header layout changed");
+
+struct SharedFrameRing {
+	std::string name;
+	uint8_t *base = nullptr;
+	size_t length = 0;
+	SharedRingHeader *header = nullptr;
+	uint64_t data_capacity = 0; // Frame bytes a slot holds
+#ifdef _WIN32
+	HANDLE mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+
+	SharedFrameRing() = default;
+	SharedFrameRing(const SharedFrameRing &) = delete;
+	SharedFrameRing &operator=(const SharedFrameRing &) = delete;
+
+	~SharedFrameRing() {
+		if (header)
+			header->closed.store(1, std::memory_order_release);
+#ifdef _WIN32
+		if (base)
+			UnmapViewOfFile(base);
+		if (mapping)
+			CloseHandle(mapping);
+#else
+		if (base)
+			munmap(base, length);
+		if (fd >= 0) {
+			close(fd);
+			shm_unlink(name.c_str());
+		}
+#endif
+	}
+
+	// Create the named ring. `name` carries the platform prefix ("/" or
+	// "Local\\"). A stale ring left by a crash is replaced.
+	static std::unique_ptr<SharedFrameRing> create(const std::string &name, uint32_t slot_count,
+						       size_t data_capacity) {
+		auto ring = std::make_unique<SharedFrameRing>();
+		ring->name = name;
+		ring->data_capacity = (data_capacity + 63) / 64 * 64;
+		uint64_t slot_size = SHARED_SLOT_DATA_OFFSET + ring->data_capacity;
+		uint64_t length = SHARED_RING_HEADER_SIZE + slot_size * slot_count;
+		ring->length = (size_t)length;
+#ifdef _WIN32
+		ring->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)(length >> 32),
+						   (DWORD)length, name.c_str());
+		if (ring->mapping && GetLastError() == ERROR_ALREADY_EXISTS) {
+			blog(LOG_ERROR, "Shared frame ring %s is already in use", name.c_str());
+			return nullptr;
+		}
+		if (ring->mapping)
+			ring->base = static_cast<uint8_t *>(MapViewOfFile(ring->mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+#else
+		ring->fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (ring->fd < 0 && errno == EEXIST) {
+			shm_unlink(name.c_str());
+			ring->fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+		}
+		if (ring->fd >= 0 && ftruncate(ring->fd, (off_t)length) == 0) {
+			void *base = mmap(nullptr, ring->length, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+			ring->base = base == MAP_FAILED ? nullptr : static_cast<uint8_t *>(base);
+		}
+#endif
+		if (!ring->base) {
+			blog(LOG_ERROR, "Failed to map %llu bytes for shared frame ring %s", (unsigned long long)length,
+			     name.c_str());
+			return nullptr;
+		}
+
+		// A fresh mapping is zeroed, so every slot starts with an even sequence
+		ring->header = new (ring->base) SharedRingHeader();
+		std::memcpy(ring->header->magic, SHARED_RING_MAGIC, sizeof(SHARED_RING_MAGIC));
+		ring->header->slot_count = slot_count;
+		ring->header->slot_size = slot_size;
+		ring->header->slots_offset = SHARED_RING_HEADER_SIZE;
+		for (uint32_t i = 0; i < slot_count; i++)
+			new (ring->slot(i)) SharedSlotHeader();
+		// Readers treat the ring as ready once the version is set
+		std::atomic_thread_fence(std::memory_order_release);
+		ring->header->version = SHARED_RING_VERSION;
+		return ring;
+	}
+
+	SharedSlotHeader *slot(uint64_t index) const {
+		uint64_t offset = header->slots_offset + header->slot_size * (index % header->slot_count);
+		return reinterpret_cast<SharedSlotHeader *>(base + offset);
+	}
+
+	// Copy a committed frame into the next slot. Its planes are already
+	// packed, so this is one copy of the slot's storage.
+	void publish(const VideoSlot &source) {
+		if (source.size > data_capacity) {
+			header->dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		uint64_t index = header->write_cursor.load(std::memory_order_relaxed);
+		SharedSlotHeader *target = slot(index);
+		uint64_t sequence = target->sequence.load(std::memory_order_relaxed);
+		target->sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		const obs_source_frame &frame = source.frame;
+		target->frame_index = index;
+		target->timestamp = frame.timestamp;
+		target->width = frame.width;
+		target->height = frame.height;
+		target->display_width = source.display_width;
+		target->display_height = source.display_height;
+		target->format = (uint32_t)frame.format;
+		target->full_range = frame.full_range;
+		target->data_size = (uint32_t)source.size;
+		for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+			target->offsets[i] = frame.data[i] ? (uint32_t)(frame.data[i] - source.storage) : 0;
+			target->linesize[i] = frame.linesize[i];
+		}
+		std::memcpy(target->color_matrix, frame.color_matrix, sizeof(target->color_matrix));
+		std::memcpy(target->color_range_min, frame.color_range_min, sizeof(target->color_range_min));
+		std::memcpy(target->color_range_max, frame.color_range_max, sizeof(target->color_range_max));
+
+		uint8_t *data = reinterpret_cast<uint8_t *>(target) + SHARED_SLOT_DATA_OFFSET;
+		copy_bytes(data, source.storage, source.size, source.size >= STREAMING_COPY_MIN_BYTES);
+		finish_streaming_copy();
+
+		target->sequence.store(sequence + 2, std::memory_order_release);
+		header->write_cursor.store(index + 1, std::memory_order_release);
+	}
+};
+
+// PCM delivered by one capture callback, located within its segment
+struct AudioChunk {
+	uint64_t timestamp = 0;
+	uint32_t offset = 0; // First frame within the segment
+	uint32_t frames = 0;
+};
+
+// Contiguous block of planar float PCM. Chunks below the count a view
+// recorded never change, so views share the block instead of copying it.
+struct AudioSegment {
+	std::vector<float> samples; // One plane of `capacity` frames per channel
+	std::vector<AudioChunk> chunks;
+	size_t capacity = 0;
+	size_t frames = 0;
+
+	AudioSegment(size_t channels, size_t frame_capacity) : samples(channels * frame_capacity), capacity(frame_capacity)
+	{
+		// Capture callbacks deliver 1024 frames; leave room for smaller ones
+		chunks.reserve(frame_capacity / 256 + 1);
+	}
+
+	bool fits(uint32_t count) const { return frames + count <= capacity && chunks.size() < chunks.capacity(); }
+};
+
+// Pinned view over the audio chunks of a ring, oldest to newest
+struct AudioView {
+	struct Part {
+		std::shared_ptr<const AudioSegment> segment;
+		size_t chunks = 0; // Chunks in the segment when the view was taken
+		size_t end = 0;    // Chunk index in the view one past this part
+	};
+	std::vector<Part> parts;
+	size_t channels = 0;
+	enum speaker_layout speakers = SPEAKERS_UNKNOWN;
+	uint32_t sample_rate = 0;
+
+	size_t size() const { return parts.empty() ? 0 : parts.back().end; }
+	bool empty() const { return size() == 0; }
+
+	uint64_t timestamp(size_t i) const
+	{
+		size_t index;
+		return locate(i, index).chunks[index].timestamp;
+	}
+
+	// The chunk as a source audio frame whose planes point into the segment
+	obs_source_audio operator[](size_t i) const
+	{
+		size_t index;
+		const AudioSegment &segment = locate(i, index);
+		const AudioChunk &chunk = segment.chunks[index];
+
+		obs_source_audio audio = {};
+		for (size_t c = 0; c < channels && c < MAX_AV_PLANES; c++) {
+			const float *plane = segment.samples.data() + c * segment.capacity + chunk.offset;
+			audio.data[c] = reinterpret_cast<const uint8_t *>(plane);
+		}
+		audio.frames = chunk.frames;
+		audio.speakers = speakers;
+		audio.format = AUDIO_FORMAT_FLOAT_PLANAR;
+		audio.samples_per_sec = sample_rate;
+		audio.timestamp = chunk.timestamp;
+		return audio;
+	}
+
+private:
+	const AudioSegment &locate(size_t i, size_t &index) const
+	{
+		auto part = std::upper_bound(parts.begin(), parts.end(), i,
+					     [](size_t value, const Part &p) { return value < p.end; });
+		index = i - (part->end - part->chunks);
+		return *part->segment;
+	}
+};
+
+// Ring of one-second PCM segments covering the buffer duration. Segments
+// are allocated up front when the format is known and then recycled, unless
+// a view still holds one. The owner provides locking.
+struct AudioRing {
+	std::deque<std::shared_ptr<AudioSegment>> segments;
+	std::vector<std::shared_ptr<AudioSegment>> free_segments;
+	size_t max_seconds = 0;
+	size_t total = 0; // Frames across all segments
+	size_t channels = 0;
+	enum speaker_layout speakers = SPEAKERS_UNKNOWN;
+	uint32_t sample_rate = 0;
+
+	void clear()
+	{
+		segments.clear();
+		free_segments.clear();
+		total = 0;
+		channels = 0;
+		speakers = SPEAKERS_UNKNOWN;
+		sample_rate = 0;
+	}
+
+	// (Re)allocate for a new format; a no-op while the format holds
+	void configure(enum speaker_layout layout, uint32_t rate)
+	{
+		if (layout == speakers && rate == sample_rate && channels != 0)
+			return;
+
+		clear();
+		speakers = layout;
+		sample_rate = rate;
+		channels = get_audio_channels(layout);
+		if (channels == 0 || sample_rate == 0 || max_seconds == 0)
+			return;
+
+		// One extra so the oldest segment can drain while the newest fills
+		for (size_t i = 0; i <= max_seconds; i++)
+			free_segments.push_back(std::make_shared<AudioSegment>(channels, sample_rate));
+	}
+
+	bool push(const uint8_t *const data[], uint32_t frames, uint64_t timestamp)
+	{
+		if (channels == 0 || frames == 0 || frames > sample_rate)
+			return false;
+
+		if (segments.empty() || !segments.back()->fits(frames)) {
+			std::shared_ptr<AudioSegment> segment;
+			if (!free_segments.empty()) {
+				segment = std::move(free_segments.back());
+				free_segments.pop_back();
+				segment->frames = 0;
+				segment->chunks.clear();
+			} else {
+				segment = std::make_shared<AudioSegment>(channels, sample_rate);
+			}
+			segments.push_back(std::move(segment));
+		}
+
+		AudioSegment &open = *segments.back();
+		for (size_t c = 0; c < channels && c < MAX_AV_PLANES; c++) {
+			float *dst = open.samples.data() + c * open.capacity + open.frames;
+			if (data[c])
+				std::memcpy(dst, data[c], frames * sizeof(float));
+			else
+				std::memset(dst, 0, frames * sizeof(float));
+		}
+
+		AudioChunk chunk;
+		chunk.timestamp = timestamp;
+		chunk.offset = (uint32_t)open.frames;
+		chunk.frames = frames;
+		open.chunks.push_back(chunk);
+		open.frames += frames;
+		total += frames;
+
+		evict_to(max_seconds * sample_rate);
+		return true;
+	}
+
+	// Evict whole segments while the rest still holds `keep_frames`
+	void evict_to(size_t keep_frames)
+	{
+		while (segments.size() > 1 && total - segments.front()->frames >= keep_frames) {
+			total -= segments.front()->frames;
+			if (segments.front().use_count() == 1)
+				free_segments.push_back(std::move(segments.front()));
+			segments.pop_front();
+		}
+	}
+
+	AudioView view() const
+	{
+		AudioView result;
+		result.channels = channels;
+		result.speakers = speakers;
+		result.sample_rate = sample_rate;
+
+		size_t end = 0;
+		for (const auto &segment : segments) {
+			if (segment->chunks.empty())
+				continue;
+			end += segment->chunks.size();
+			result.parts.push_back({segment, segment->chunks.size(), end});
+		}
+		return result;
+	}
+};
+
+// Everything a replay or save needs from one buffer, pinned at one instant
+struct FrameSnapshot {
+	VideoView video;
+	AudioView audio;
+};
+
+// GPU copy of one composited frame. Destroying it enters the graphics
+// context, so the last reference must never be dropped while holding a lock
+// the render thread also takes.
+struct TextureSlot {
+	gs_texture_t *texture = nullptr;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	enum gs_color_format format = GS_UNKNOWN;
+	uint32_t display_width = 0; // Before a capture profile scaled it
+	uint32_t display_height = 0;
+	uint64_t timestamp = 0;
+
+	TextureSlot() = default;
+	TextureSlot(const TextureSlot &) = delete;
+	TextureSlot &operator=(const TextureSlot &) = delete;
+
+	~TextureSlot()
+	{
+		if (texture) {
+			obs_enter_graphics();
+			gs_texture_destroy(texture);
+			obs_leave_graphics();
+		}
+	}
+
+	bool matches(uint32_t cx, uint32_t cy, enum gs_color_format fmt) const
+	{
+		return width == cx && height == cy && format == fmt;
+	}
+};
+
+using TextureFrames = std::vector<std::shared_ptr<TextureSlot>>;
+
+// How much of its video a buffer keeps: every `frame_interval`th frame,
+// with each dimension divided by `scale_divisor`
+struct CaptureProfile {
+	uint32_t scale_divisor = 1; // 1, 2 or 4
+	uint32_t frame_interval = 1;
+
+	bool is_full() const { return scale_divisor == 1 && frame_interval == 1; }
+
+	bool operator==(const CaptureProfile &other) const {
+		return scale_divisor == other.scale_divisor && frame_interval == other.frame_interval;
+	}
+	bool operator!=(const CaptureProfile &other) const { return !(*this == other); }
+
+	// Stored size of a frame; even, so 4:2:0 chroma stays whole
+	uint32_t scaled(uint32_t size) const {
+		return scale_divisor > 1 ? std::max<uint32_t>(2, (size / scale_divisor) & ~1u) : size;
+	}
+};
+
+// Draw `source` stretched over all of `target`. Runs in the graphics context
+// and is defined by the including translation unit.
+static void scale_texture(gs_texture_t *target, gs_texture_t *source);
+
+// VRAM the texture ring of the live scene may use
+static const uint64_t MAX_TEXTURE_RING_BYTES = 2048ull * 1024 * 1024;
+
+// Raw video bytes held by all buffers, checked against the memory budget
+static std::atomic<uint64_t> buffered_video_bytes{0};
+static std::atomic<uint64_t> memory_budget_mb{8192};
+// Called by capture once the budget is exceeded. The eviction across buffers
+// happens elsewhere; this must neither block nor allocate.
+static void request_memory_reclaim();
+
+static uint64_t get_memory_budget_bytes()
+{
+	return memory_budget_mb.load() * 1024 * 1024;
+}
+
+// Circular buffer for caching frames
+struct FrameBuffer {
+	// Guards everything below. Writers hold it for one copy, readers only
+	// long enough to pin segments, so capture never waits on playback or
+	// saving.
+	mutable std::mutex mutex;
+
+	// Segmented rings of reusable frame slots. Slots are allocated on first
+	// use and then recycled, so steady-state capture does not allocate.
+	SegmentRing<VideoSlot> video;
+	std::atomic<size_t> max_frames;
+	size_t segment_frames;
+
+	// History limits. Video is evicted by timestamp once the rest covers the
+	// duration, and by the global memory budget (see request_memory_reclaim).
+	std::atomic<size_t> max_seconds{0};
+	uint64_t max_video_ns = 0;
+	std::atomic<uint64_t> video_bytes{0};
+
+	// os_gettime_ns() when the scene last left program; 0 while it is live
+	std::atomic<uint64_t> idle_since{0};
+
+	// Disk tier: closed video segments older than the hot window are moved
+	// into a memory mapped file. Only the spill worker touches the file.
+	std::unique_ptr<SpillFile> spill_file;
+	bool spill_failed = false; // Don't retry a file that could not be created
+
+	// Shared-memory export of the newest raw frames, opted into per buffer.
+	// The ring is created on the first frame after it is set up, sized for it.
+	std::string shared_name;
+	uint32_t shared_frames = 0;
+	std::unique_ptr<SharedFrameRing> shared_ring;
+	bool shared_failed = false;
+
+	// Planar float PCM with the capture timestamps of each callback
+	AudioRing audio;
+
+	// Encoded mode: interleaved audio/video packets. The ring always starts
+	// on a video keyframe and is trimmed one GOP at a time.
+	std::deque<std::shared_ptr<encoder_packet>> packets;
+	int64_t max_packet_usec = 0;
+	int64_t newest_video_usec = 0;
+
+	// Texture mode: GPU copies of the program output, oldest first. Slots
+	// are reused once no snapshot holds them.
+	std::deque<std::shared_ptr<TextureSlot>> textures;
+
+	// Layout the slots are currently sized for
+	uint32_t slot_width = 0;
+	uint32_t slot_height = 0;
+	enum video_format slot_format = VIDEO_FORMAT_NONE;
+
+	// Capture profile, and the scaler from the last source layout to its
+	// size. A layout the scaler can't convert is kept at full size.
+	CaptureProfile profile;
+	uint64_t frames_offered = 0;
+	video_scaler_t *scaler = nullptr;
+	uint32_t scaler_width = 0;
+	uint32_t scaler_height = 0;
+	enum video_format scaler_format = VIDEO_FORMAT_NONE;
+
+	FrameBuffer() : max_frames(0), segment_frames(0) {}
+
+	// One-second video segments at the output frame rate
+	FrameBuffer(size_t seconds, uint32_t fps_num, uint32_t fps_den) : max_frames(0), segment_frames(0)
+	{
+		set_duration_locked(seconds, fps_num, fps_den);
+	}
+
+	FrameBuffer(const FrameBuffer &) = delete;
+	FrameBuffer &operator=(const FrameBuffer &) = delete;
+
+	~FrameBuffer() {
+		buffered_video_bytes -= video_bytes;
+		video_scaler_destroy(scaler);
+	}
+
+	// A shorter history is trimmed right away, so capture never has more
+	// than one segment to evict per frame. The trimmed segments, and the
+	// spare they displace, go to `trimmed` to be freed by the caller.
+	void set_duration(size_t seconds, uint32_t fps_num, uint32_t fps_den,
+			  std::vector<std::shared_ptr<const void>> &trimmed) {
+		std::lock_guard<std::mutex> lock(mutex);
+		set_duration_locked(seconds, fps_num, fps_den);
+		if (video.total == 0)
+			return;
+		if (video.spare)
+			trimmed.push_back(video.spare);
+		evict_video_older_than_locked(newest_video_timestamp_locked(), max_video_ns, &trimmed);
+	}
+
+	void set_duration_locked(size_t seconds, uint32_t fps_num, uint32_t fps_den) {
+		if (fps_den == 0 || fps_num == 0) {
+			fps_num = 60;
+			fps_den = 1;
+		}
+
+		// Segments stay one second long when a profile thins the frames out
+		fps_den *= profile.frame_interval;
+		max_seconds = seconds;
+		max_frames = (size_t)((seconds * fps_num + fps_den - 1) / fps_den);
+		segment_frames = std::max<size_t>(1, (fps_num + fps_den - 1) / fps_den);
+		max_video_ns = (uint64_t)seconds * 1000000000ULL;
+		max_packet_usec = (int64_t)seconds * 1000000;
+		audio.max_seconds = seconds;
+	}
+
+	// A new profile drops the raw and texture history, since frames of both
+	// sizes could not be played or saved as one clip
+	void set_profile(const CaptureProfile &new_profile, uint32_t fps_num, uint32_t fps_den) {
+		std::deque<std::shared_ptr<TextureSlot>> released;
+		std::lock_guard<std::mutex> lock(mutex);
+		if (new_profile == profile)
+			return;
+
+		profile = new_profile;
+		frames_offered = 0;
+		set_duration_locked(max_seconds, fps_num, fps_den);
+		if (slot_width != 0) {
+			video.reset(segment_frames, SIZE_MAX);
+			release_video_bytes(video_bytes);
+		}
+		video_scaler_destroy(scaler);
+		scaler = nullptr;
+		scaler_width = scaler_height = 0;
+		scaler_format = VIDEO_FORMAT_NONE;
+		released.swap(textures);
+	}
+
+	CaptureProfile get_profile() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return profile;
+	}
+
+	// Whether the profile's frame interval skips this frame. The caller
+	// holds the mutex.
+	bool thin_out_locked() {
+		if (profile.frame_interval <= 1 || frames_offered++ % profile.frame_interval == 0)
+			return false;
+		count_capture_event(CaptureEvent::VideoThinned);
+		return true;
+	}
+
+	// Scaler from the given source layout to the profile's size, or nullptr
+	// to store frames as they come. The caller holds the mutex.
+	video_scaler_t *get_scaler_locked(uint32_t width, uint32_t height, enum video_format format) {
+		if (profile.scale_divisor <= 1)
+			return nullptr;
+		if (width == scaler_width && height == scaler_height && format == scaler_format)
+			return scaler;
+
+		video_scaler_destroy(scaler);
+		scaler = nullptr;
+		scaler_width = width;
+		scaler_height = height;
+		scaler_format = format;
+
+		struct video_scale_info src = {format, width, height, VIDEO_RANGE_DEFAULT, VIDEO_CS_DEFAULT};
+		struct video_scale_info dst = {format, profile.scaled(width), profile.scaled(height), VIDEO_RANGE_DEFAULT,
+					       VIDEO_CS_DEFAULT};
+		if (video_scaler_create(&scaler, &dst, &src, VIDEO_SCALE_BILINEAR) != VIDEO_SCALER_SUCCESS) {
+			scaler = nullptr;
+			blog(LOG_WARNING, "Can't scale %s frames for a capture profile; keeping them at full size",
+			     get_video_format_name(format));
+		}
+		return scaler;
+	}
+
+	// Cut the history down to its newest `seconds`, for scenes that have
+	// been off program for a while
+	void trim_to(size_t seconds) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (video.total > 0)
+			evict_video_older_than_locked(newest_video_timestamp_locked(), (uint64_t)seconds * 1000000000ULL);
+		audio.evict_to(seconds * audio.sample_rate);
+		evict_oldest_gops((int64_t)seconds * 1000000);
+	}
+
+	// Timestamp of the newest committed frame. The caller holds the mutex
+	// and checks that the ring is not empty.
+	uint64_t newest_video_timestamp_locked() const {
+		// The open segment may not have a committed frame yet
+		auto newest_segment = video.segments.rbegin();
+		while ((*newest_segment)->count == 0)
+			++newest_segment;
+		const Segment<VideoSlot> &newest = **newest_segment;
+		return newest.entries[newest.count - 1].frame.timestamp;
+	}
+
+	// Move the oldest closed segment that has left the hot window into the
+	// spill file. The copy runs without the mutex; the segment is immutable
+	// and stays pinned meanwhile. Returns true if a segment was spilled.
+	bool spill_oldest_segment(uint64_t hot_ns, const std::string &directory) {
+		std::shared_ptr<Segment<VideoSlot>> hot;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (video.segments.size() < 2)
+				return false;
+
+			uint64_t newest_timestamp = newest_video_timestamp_locked();
+			for (size_t i = 0; i + 1 < video.segments.size(); i++) {
+				const std::shared_ptr<Segment<VideoSlot>> &segment = video.segments[i];
+				if (segment->backing || segment->count == 0)
+					continue;
+
+				uint64_t last_timestamp = segment->entries[segment->count - 1].frame.timestamp;
+				if (newest_timestamp >= last_timestamp && newest_timestamp - last_timestamp < hot_ns)
+					return false;
+				hot = segment;
+				break;
+			}
+		}
+		if (!hot || spill_failed)
+			return false;
+
+		size_t bytes = 0;
+		for (size_t i = 0; i < hot->count; i++)
+			bytes += hot->entries[i].size;
+
+		if (!spill_file && !spill_failed) {
+			spill_file = SpillFile::open(directory);
+			spill_failed = !spill_file;
+		}
+		std::shared_ptr<SpillMapping> mapping =
+			spill_file ? spill_file->allocate(bytes, hot->entries[0].frame.timestamp) : nullptr;
+		if (!mapping)
+			return false;
+
+		auto cold = std::make_shared<Segment<VideoSlot>>(hot->entries.size());
+		uint8_t *cursor = mapping->data();
+		for (size_t i = 0; i < hot->count; i++) {
+			const VideoSlot &src = hot->entries[i];
+			VideoSlot &dst = cold->entries[i];
+			std::memcpy(cursor, src.storage, src.size);
+			dst.frame = src.frame;
+			dst.size = src.size;
+			dst.display_width = src.display_width;
+			dst.display_height = src.display_height;
+			for (size_t p = 0; p < MAX_AV_PLANES; p++) {
+				if (src.frame.data[p])
+					dst.frame.data[p] = cursor + (src.frame.data[p] - src.storage);
+			}
+			cursor += src.size;
+		}
+		cold->count = hot->count;
+		cold->backing = mapping;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!video.replace(hot, cold))
+			return false; // Evicted or reset while copying
+		release_video_bytes(bytes);
+		return true;
+	}
+
+	// Bytes of slot data per second of configured history, used to pick
+	// which buffer gives way when the memory budget runs out
+	uint64_t video_bytes_per_second() const {
+		size_t seconds = max_seconds;
+		return seconds ? video_bytes / seconds : video_bytes.load();
+	}
+
+	// Drop the oldest video segment to reclaim memory. Returns false if only
+	// the open segment is left.
+	bool evict_oldest_segment() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return evict_oldest_video_locked();
+	}
+
+	// With `trimmed`, the segment is handed out instead of freed here
+	bool evict_oldest_video_locked(std::vector<std::shared_ptr<const void>> *trimmed = nullptr) {
+		std::shared_ptr<const Segment<VideoSlot>> evicted = video.evict_oldest();
+		if (!evicted)
+			return false;
+		if (trimmed)
+			trimmed->push_back(evicted);
+
+		// Spilled segments hold no memory of their own
+		uint64_t bytes = 0;
+		for (size_t i = 0; !evicted->backing && i < evicted->count; i++)
+			bytes += evicted->entries[i].size;
+		release_video_bytes(bytes);
+		count_capture_event(CaptureEvent::VideoEvicted, evicted->count);
+		return true;
+	}
+
+	void release_video_bytes(uint64_t bytes) {
+		bytes = std::min<uint64_t>(bytes, video_bytes);
+		video_bytes -= bytes;
+		buffered_video_bytes -= bytes;
+	}
+
+	// Drop whole segments from the front while the rest still covers the
+	// duration. The frame count is only a backstop for stalled timestamps.
+	// The caller holds the buffer mutex.
+	void evict_expired_video_locked(uint64_t newest_timestamp) {
+		evict_video_older_than_locked(newest_timestamp, max_video_ns);
+	}
+
+	void evict_video_older_than_locked(uint64_t newest_timestamp, uint64_t keep_ns,
+					   std::vector<std::shared_ptr<const void>> *trimmed = nullptr) {
+		while (video.segments.size() > 1) {
+			if (video.total - video.segments.front()->count >= max_frames * 2) {
+				evict_oldest_video_locked(trimmed);
+				continue;
+			}
+
+			uint64_t next_timestamp = video.segments[1]->entries[0].frame.timestamp;
+			if (newest_timestamp >= next_timestamp && newest_timestamp - next_timestamp < keep_ns)
+				break;
+			evict_oldest_video_locked(trimmed);
+		}
+	}
+
+	void clear() {
+		// Released after the lock so the textures are destroyed without it
+		std::deque<std::shared_ptr<TextureSlot>> released;
+		std::lock_guard<std::mutex> lock(mutex);
+		released.swap(textures);
+
+		// Segments still pinned by a snapshot are freed when it lets go
+		video.reset(0, 0);
+		release_video_bytes(video_bytes);
+		slot_width = 0;
+		slot_height = 0;
+		slot_format = VIDEO_FORMAT_NONE;
+		audio.clear();
+
+		packets.clear();
+		newest_video_usec = 0;
+	}
+
+	void configure(uint32_t width, uint32_t height, enum video_format format) {
+		std::lock_guard<std::mutex> lock(mutex);
+		configure_locked(width, height, format);
+	}
+
+	// Drop every segment if the output layout changed, so the slots are
+	// re-allocated at the new size
+	void configure_locked(uint32_t width, uint32_t height, enum video_format format) {
+		if (width == slot_width && height == slot_height && format == slot_format && video.capacity != 0)
+			return;
+
+		if (video.total > 0) {
+			blog(LOG_INFO, "Video layout changed to %ux%u (format %d); recycling frame slots.",
+				width, height, format);
+		}
+
+		// Eviction is by timestamp and budget, not by the ring itself
+		video.reset(segment_frames, SIZE_MAX);
+		release_video_bytes(video_bytes);
+		slot_width = width;
+		slot_height = height;
+		slot_format = format;
+	}
+
+	// Copy a frame into the next ring slot. Source frames carry their own
+	// colour parameters in `color`; frames from the output take them at
+	// playback.
+	bool add_video_frame(const video_data *frame, uint32_t width, uint32_t height, enum video_format format,
+			     const obs_source_frame *color = nullptr) {
+		bool added = copy_video_frame(frame, width, height, format, color);
+
+		// Reclaiming locks other buffers, so it is only requested here
+		if (added && buffered_video_bytes > get_memory_budget_bytes())
+			request_memory_reclaim();
+		return added;
+	}
+
+	bool copy_video_frame(const video_data *frame, uint32_t width, uint32_t height, enum video_format format,
+			      const obs_source_frame *color) {
+		if (!plugin_enabled)
+			return false;
+		if (!frame || width == 0 || height == 0 || max_frames == 0) {
+			count_capture_event(CaptureEvent::VideoRejected);
+			return false;
+		}
+
+		PlaneFormat layout;
+		bool valid = get_plane_format(format, layout);
+		for (size_t i = 0; valid && i < layout.planes; i++)
+			valid = frame->data[i] && frame->linesize[i] >= layout.row_bytes(i, width);
+		if (!valid) {
+			count_capture_event(CaptureEvent::VideoRejected);
+			return false;
+		}
+
+		TimedLock lock(mutex, replay_stats.buffer_lock_wait);
+		if (thin_out_locked())
+			return false;
+
+		// A profile scales straight into the slot; otherwise planes are
+		// copied packed, without the source's row padding
+		video_scaler_t *frame_scaler = get_scaler_locked(width, height, format);
+		uint32_t stored_width = frame_scaler ? profile.scaled(width) : width;
+		uint32_t stored_height = frame_scaler ? profile.scaled(height) : height;
+		configure_locked(stored_width, stored_height, format);
+
+		size_t row_bytes[MAX_AV_PLANES] = {0};
+		size_t offsets[MAX_AV_PLANES] = {0};
+		size_t total_size = 0;
+		for (size_t i = 0; i < layout.planes; i++) {
+			row_bytes[i] = layout.row_bytes(i, stored_width);
+			offsets[i] = total_size;
+			total_size += align_plane_size(row_bytes[i] * layout.rows(i, stored_height));
+		}
+
+		// Slots in a recycled segment keep their storage unless this frame
+		// is larger
+		VideoSlot *slot = video.next_entry();
+		if (!slot || !slot->reserve(total_size)) {
+			video.cancel_entry();
+			count_capture_event(CaptureEvent::SlotFailure);
+			return false;
+		}
+		slot->size = total_size;
+		slot->display_width = width;
+		slot->display_height = height;
+
+		obs_source_frame &dst = slot->frame;
+		dst = {};
+		dst.width = stored_width;
+		dst.height = stored_height;
+		dst.format = format;
+		dst.timestamp = frame->timestamp;
+		if (color) {
+			std::memcpy(dst.color_matrix, color->color_matrix, sizeof(dst.color_matrix));
+			std::memcpy(dst.color_range_min, color->color_range_min, sizeof(dst.color_range_min));
+			std::memcpy(dst.color_range_max, color->color_range_max, sizeof(dst.color_range_max));
+			dst.full_range = color->full_range;
+			dst.trc = color->trc;
+			dst.flip = color->flip;
+		}
+
+		for (size_t i = 0; i < layout.planes; i++) {
+			dst.data[i] = slot->storage + offsets[i];
+			dst.linesize[i] = (uint32_t)row_bytes[i];
+			if (!frame_scaler)
+				copy_plane(dst.data[i], frame->data[i], frame->linesize[i], row_bytes[i],
+					   layout.rows(i, height));
+		}
+		if (frame_scaler && !video_scaler_scale(frame_scaler, dst.data, dst.linesize, frame->data, frame->linesize)) {
+			video.cancel_entry();
+			count_capture_event(CaptureEvent::VideoRejected);
+			return false;
+		}
+		finish_streaming_copy();
+
+		video.commit();
+		publish_shared_locked(*slot);
+		video_bytes += total_size;
+		buffered_video_bytes += total_size;
+		evict_expired_video_locked(dst.timestamp);
+		count_capture_event(CaptureEvent::VideoFrame);
+		return true;
+	}
+
+	// Mirror raw frames into the shared ring `name`, keeping the newest
+	// `frames`. 0 frames stops the export.
+	void set_shared_export(const std::string &name, uint32_t frames) {
+		std::unique_ptr<SharedFrameRing> released; // Unmapped after the lock
+		std::lock_guard<std::mutex> lock(mutex);
+		released.swap(shared_ring);
+		shared_name = frames ? name : "";
+		shared_frames = frames;
+		shared_failed = false;
+	}
+
+	void publish_shared_locked(const VideoSlot &slot) {
+		if (shared_frames == 0 || shared_failed)
+			return;
+
+		if (!shared_ring) {
+			// 4 bytes per pixel, so a later switch to a packed format still fits
+			size_t capacity = std::max<size_t>(slot.size, (size_t)slot.frame.width * slot.frame.height * 4);
+			shared_ring = SharedFrameRing::create(shared_name, shared_frames, capacity);
+			shared_failed = !shared_ring;
+			if (!shared_ring)
+				return;
+			blog(LOG_INFO, "Publishing %u frames of %ux%u to shared ring %s", shared_frames,
+			     slot.frame.width, slot.frame.height, shared_name.c_str());
+		}
+		shared_ring->publish(slot);
+	}
+
+	// Async frame from a filtered source
+	bool add_source_frame(const obs_source_frame *frame) {
+		if (!frame)
+			return false;
+
+		video_data data = {};
+		for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+			data.data[i] = frame->data[i];
+			data.linesize[i] = frame->linesize[i];
+		}
+		data.timestamp = frame->timestamp;
+		return add_video_frame(&data, frame->width, frame->height, frame->format, frame);
+	}
+
+	// Capture callbacks deliver the mix format: planar float
+	void add_audio(const audio_data *data) {
+		if (!plugin_enabled || !data)
+			return;
+
+		const struct audio_output_info *aoi = audio_output_get_info(obs_get_audio());
+		if (!aoi)
+			return;
+
+		TimedLock lock(mutex, replay_stats.buffer_lock_wait);
+		audio.configure(aoi->speakers, aoi->samples_per_sec);
+		audio.push(data->data, data->frames, data->timestamp);
+		count_capture_event(CaptureEvent::AudioChunk);
+	}
+
+	void add_packet(struct encoder_packet *packet) {
+		if (!plugin_enabled || !packet)
+			return;
+
+		bool is_video = packet->type == OBS_ENCODER_VIDEO;
+
+		TimedLock lock(mutex, replay_stats.buffer_lock_wait);
+
+		// Nothing before the first keyframe can be decoded
+		if (packets.empty() && !(is_video && packet->keyframe))
+			return;
+
+		packets.push_back(make_packet_ref(packet));
+		if (is_video)
+			newest_video_usec = packet->dts_usec;
+
+		evict_oldest_gops(max_packet_usec);
+		count_capture_event(CaptureEvent::Packet);
+	}
+
+	// Drop whole GOPs from the front while the rest still covers `keep_usec`.
+	// The caller holds the buffer mutex.
+	void evict_oldest_gops(int64_t keep_usec) {
+		while (!packets.empty()) {
+			size_t next_keyframe = 0;
+			for (size_t i = 1; i < packets.size(); i++) {
+				const encoder_packet *p = packets[i].get();
+				if (p->type == OBS_ENCODER_VIDEO && p->keyframe) {
+					next_keyframe = i;
+					break;
+				}
+			}
+
+			if (next_keyframe == 0 ||
+			    newest_video_usec - packets[next_keyframe]->dts_usec < keep_usec)
+				break;
+
+			packets.erase(packets.begin(), packets.begin() + next_keyframe);
+		}
+	}
+
+	// Copy the finished program texture into the ring. Called on the
+	// graphics thread, which is why slots may be destroyed under the lock.
+	bool add_texture_frame(gs_texture_t *source, uint64_t timestamp) {
+		if (!plugin_enabled || !source || max_frames == 0)
+			return false;
+
+		uint32_t display_width = gs_texture_get_width(source);
+		uint32_t display_height = gs_texture_get_height(source);
+		enum gs_color_format format = gs_texture_get_color_format(source);
+
+		TimedLock lock(mutex, replay_stats.buffer_lock_wait);
+		if (thin_out_locked())
+			return false;
+
+		// A profile scales on the GPU, so only the smaller frame is kept
+		uint32_t width = profile.scaled(display_width);
+		uint32_t height = profile.scaled(display_height);
+		uint64_t frame_bytes = (uint64_t)width * height * gs_get_format_bpp(format) / 8;
+		if (frame_bytes == 0)
+			return false;
+		size_t limit = (size_t)std::max<uint64_t>(1, std::min<uint64_t>(max_frames, MAX_TEXTURE_RING_BYTES / frame_bytes));
+
+		if (!textures.empty() && !textures.back()->matches(width, height, format)) {
+			blog(LOG_INFO, "Program texture changed to %ux%u; dropping texture ring.", width, height);
+			textures.clear();
+		}
+
+		std::shared_ptr<TextureSlot> slot;
+		while (textures.size() >= limit) {
+			if (!slot && textures.front().use_count() == 1)
+				slot = std::move(textures.front());
+			textures.pop_front();
+		}
+
+		if (!slot) {
+			slot = std::make_shared<TextureSlot>();
+			slot->texture = gs_texture_create(width, height, format, 1, nullptr, GS_RENDER_TARGET);
+			if (!slot->texture) {
+				count_capture_event(CaptureEvent::SlotFailure);
+				return false;
+			}
+			slot->width = width;
+			slot->height = height;
+			slot->format = format;
+		}
+
+		if (width == display_width && height == display_height)
+			gs_copy_texture(slot->texture, source);
+		else
+			scale_texture(slot->texture, source);
+		slot->display_width = display_width;
+		slot->display_height = display_height;
+		slot->timestamp = timestamp;
+		textures.push_back(std::move(slot));
+		count_capture_event(CaptureEvent::TextureFrame);
+		return true;
+	}
+
+	// Pin the texture ring, oldest to newest
+	TextureFrames texture_snapshot() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return TextureFrames(textures.begin(), textures.end());
+	}
+
+	// Hand back the VRAM of a scene that is no longer live
+	void release_textures()
+	{
+		std::deque<std::shared_ptr<TextureSlot>> released;
+		std::lock_guard<std::mutex> lock(mutex);
+		released.swap(textures);
+	}
+
+	bool has_textures() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return !textures.empty();
+	}
+
+	std::vector<std::shared_ptr<encoder_packet>> get_packets()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return std::vector<std::shared_ptr<encoder_packet>>(packets.begin(), packets.end());
+	}
+
+	// Pin the current contents, oldest to newest. Only segment pointers are
+	// copied; the writer will not recycle a pinned segment.
+	FrameSnapshot snapshot() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		FrameSnapshot result;
+		result.video = video.view();
+		result.audio = audio.view();
+		return result;
+	}
+
+	size_t video_frame_count() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return video.total;
+	}
+
+	// What the buffer holds, for GetReplayStats
+	struct Usage {
+		size_t video_frames = 0;
+		uint64_t video_bytes = 0;   // In RAM
+		uint64_t spilled_bytes = 0; // In the spill file
+		uint64_t shared_bytes = 0;  // Mapped for the shared-memory export
+		double video_seconds = 0.0;
+		uint64_t audio_bytes = 0; // Allocated, including free segments
+		size_t texture_frames = 0;
+		uint64_t texture_bytes = 0; // VRAM
+		size_t packets = 0;
+		uint64_t packet_bytes = 0;
+	};
+
+	Usage get_usage() const
+	{
+		Usage usage;
+		std::lock_guard<std::mutex> lock(mutex);
+		usage.video_frames = video.total;
+		usage.video_bytes = video_bytes;
+		for (const auto &segment : video.segments) {
+			for (size_t i = 0; segment->backing && i < segment->count; i++)
+				usage.spilled_bytes += segment->entries[i].size;
+		}
+		const Segment<VideoSlot> *oldest = nullptr;
+		const Segment<VideoSlot> *newest = nullptr;
+		for (const auto &segment : video.segments) {
+			if (segment->count == 0)
+				continue;
+			if (!oldest)
+				oldest = segment.get();
+			newest = segment.get();
+		}
+		if (oldest)
+			usage.video_seconds = (double)(newest->entries[newest->count - 1].frame.timestamp -
+						       oldest->entries[0].frame.timestamp) /
+					      1e9;
+
+		usage.audio_bytes = (uint64_t)(audio.segments.size() + audio.free_segments.size()) * audio.channels *
+				    audio.sample_rate * sizeof(float);
+		usage.texture_frames = textures.size();
+		for (const auto &slot : textures)
+			usage.texture_bytes += (uint64_t)slot->width * slot->height * gs_get_format_bpp(slot->format) / 8;
+		usage.packets = packets.size();
+		for (const auto &packet : packets)
+			usage.packet_bytes += packet->size;
+		usage.shared_bytes = shared_ring ? shared_ring->length : 0;
+		return usage;
+	}
+
+	bool has_packets() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return !packets.empty();
+	}
+};
@@ -2,6 +2,13 @@
 #include <obs-frontend-api.h>
 #include <obs-source.h>
 #include <obs-websocket-api.h>
+#include <util/platform.h>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+}
 
 #include <memory>
 #include <deque>
@@ -13,6 +20,22 @@
 #include <set>
 #include <thread>
 #include <chrono>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <cstring>
+#include <algorithm>
+#include <cstdint>
+#include <ctime>
+#include <cctype>
+
+#if defined(__APPLE__)
+#include <pthread.h>
+#elif defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 #include <QDialog>
 #include <QPushButton>
@@ -23,7 +46,13 @@
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QLabel>
+#include <QComboBox>
+#include <QSpinBox>
 #include <QString>
+#include <QEvent>
+#include <QCoreApplication>
+
+#include "FrameBuffer.h"
 
 // Plugin Version Information
 #define PLUGIN_VERSION "1.0.0"
@@ -47,161 +76,340 @@ MODULE_EXPORT const char *obs_module_name(void)
 	return "obs-replay-plugin";
 }
 
-bool plugin_enabled = true;
+// Enabled from load. Written on the UI thread and read by every capture
+// callback, which stay attached and return early while it is off.
+std::atomic<bool> plugin_enabled{true};
 static bool plugin_fully_initialized = false;
 
 // Forward declarations
-static std::mutex buffer_mutex;
+static std::mutex buffer_mutex; // Guards the buffer maps; each FrameBuffer has its own lock
+static void *replay_filter_create(obs_data_t *settings, obs_source_t *source);
+static void replay_filter_destroy(void *data);
+static void replay_filter_add(void *data, obs_source_t *parent);
+static void replay_filter_remove(void *data, obs_source_t *parent);
+static struct obs_source_frame *replay_filter_video(void *data, struct obs_source_frame *frame);
+static void *replay_source_create(obs_data_t *settings, obs_source_t *source);
 static void replay_source_destroy(void *data);
+static void replay_source_tick(void *data, float seconds);
 static void replay_source_render(void *data, gs_effect_t *effect);
-void enumerate_sources(std::function<void(obs_source_t *)> callback);
-void audio_callback(void *param, obs_source_t *source, const audio_data *audio, bool muted);
-void video_render_callback(void *param, obs_source_t *source, const struct video_data *frame);
-
-// Circular buffer for caching frames
-struct FrameBuffer {
-	std::deque<std::shared_ptr<obs_source_frame>> video_frames;
-	std::deque<std::shared_ptr<obs_source_audio>> audio_frames;
-	size_t max_frames;
-
-	FrameBuffer() : max_frames(0) {}
-
-	FrameBuffer(size_t max_seconds, int fps) : max_frames(max_seconds * fps) {}
-
-	~FrameBuffer() {
-		clear();
-	}
-
-	void clear() {
-		// Clean up video frames
-		for (auto &frame : video_frames) {
-			if (frame) {
-				for (size_t i = 0; i < MAX_AV_PLANES; i++) {
-					if (frame->data[i]) {
-						bfree((void*)frame->data[i]);
-						frame->data[i] = nullptr;
-					}
-				}
-			}
-		}
-		video_frames.clear();
-
-		// Clean up audio frames
-		for (auto &frame : audio_frames) {
-			if (frame) {
-				for (size_t i = 0; i < MAX_AV_PLANES; i++) {
-					if (frame->data[i]) {
-						bfree((void*)frame->data[i]);
-						frame->data[i] = nullptr;
-					}
-				}
-			}
-		}
-		audio_frames.clear();
-	}
-
-	void add_video_frame(std::shared_ptr<obs_source_frame> frame) {
-		if (!plugin_enabled) {
-			blog(LOG_DEBUG, "Plugin is disabled; skipping frame addition.");
-			return;
-		}
-		if (!frame) {
-			blog(LOG_WARNING, "Received null frame; skipping.");
-			return;
-		}
-
-		std::lock_guard<std::mutex> lock(buffer_mutex);
-		blog(LOG_DEBUG, "Adding frame - Width: %d, Height: %d, Format: %d", 
-			frame->width, frame->height, frame->format);
-
-		if (video_frames.size() >= max_frames) {
-			blog(LOG_INFO, "Buffer is full; removing oldest frame.");
-			auto oldest = video_frames.front();
-			if (oldest) {
-				for (size_t i = 0; i < MAX_AV_PLANES; i++) {
-					if (oldest->data[i]) {
-						bfree((void*)oldest->data[i]);
-						oldest->data[i] = nullptr;
-					}
-				}
-			}
-			video_frames.pop_front();
-		}
-
-		if (frame->width > 0 && frame->height > 0) {
-			video_frames.push_back(frame);
-			blog(LOG_DEBUG, "Added frame to buffer. New buffer size: %zu", video_frames.size());
-		} else {
-			blog(LOG_WARNING, "Invalid frame dimensions: width=%d, height=%d; skipping.", frame->width, frame->height);
-		}
-	}
-
-	// Similar cleanup for add_audio_frame
-	void add_audio_frame(std::shared_ptr<obs_source_audio> frame) {
-		if (!plugin_enabled || !frame)
-			return;
-
-		if (audio_frames.size() >= max_frames) {
-			// Clean up the oldest frame before removing it
-			auto oldest = audio_frames.front();
-			if (oldest) {
-				for (size_t i = 0; i < MAX_AV_PLANES; i++) {
-					if (oldest->data[i]) {
-						bfree((void*)oldest->data[i]);
-					}
-				}
-			}
-			audio_frames.pop_front();
-		}
-		audio_frames.push_back(frame);
-	}
+static uint32_t replay_source_get_width(void *data);
+static uint32_t replay_source_get_height(void *data);
+static void replay_source_enum_sources(void *data, obs_source_enum_proc_t enum_callback, void *param);
+static obs_source_t *replay_source_get_clip(obs_source_t *source);
+
+// How the replay history is stored
+enum class BufferMode {
+	Raw,     // Uncompressed frames from the raw video callback
+	Encoded, // Compressed packets from a dedicated encoder pair
+	Texture, // GPU copies of the program output, read back only on save
+};
+static std::atomic<BufferMode> buffer_mode{BufferMode::Raw};
 
-	std::vector<std::shared_ptr<obs_source_frame>> get_video_frames()
-	{
-		return std::vector<std::shared_ptr<obs_source_frame>>(video_frames.begin(), video_frames.end());
+static const char *get_buffer_mode_name(BufferMode mode)
+{
+	switch (mode) {
+	case BufferMode::Encoded:
+		return "encoded";
+	case BufferMode::Texture:
+		return "texture";
+	default:
+		return "raw";
 	}
+}
 
-	std::vector<std::shared_ptr<obs_source_audio>> get_audio_frames()
-	{
-		return std::vector<std::shared_ptr<obs_source_audio>>(audio_frames.begin(), audio_frames.end());
-	}
+// Every hold of buffer_mutex goes through here
+struct BufferMapLock : TimedLock {
+	BufferMapLock() : TimedLock(buffer_mutex, replay_stats.map_lock_wait) {}
 };
 
 // Global variables and mutexes
-static std::map<std::string, FrameBuffer> scene_buffers;
+static std::map<std::string, std::shared_ptr<FrameBuffer>> scene_buffers;
+static std::map<std::string, std::shared_ptr<FrameBuffer>> source_buffers; // Owned by replay_capture filters
+
+// History length per buffer: a default plus per scene or source overrides.
+// The overrides are guarded by buffer_mutex.
+static const int MAX_BUFFER_SECONDS = 600;
+static std::atomic<int> default_buffer_seconds{30};
+static std::map<std::string, int> buffer_durations;
+
+// Scenes and sources that keep less than full video, for example secondary
+// cameras. Not listed means full size at the output frame rate. Guarded by
+// buffer_mutex.
+static const uint32_t MAX_FRAME_INTERVAL = 60;
+static std::map<std::string, CaptureProfile> capture_profiles;
+
+// Scenes cut into a clip by a marker whenever they leave program. Guarded
+// by buffer_mutex.
+static std::set<std::string> clip_on_leave_scenes;
+
+// Scenes and sources whose raw frames are mirrored into a shared-memory
+// ring for external tools, with the frames each ring holds. Guarded by
+// buffer_mutex.
+static const uint32_t DEFAULT_SHARED_FRAMES = 60;
+static const uint32_t MAX_SHARED_FRAMES = 600;
+static std::map<std::string, uint32_t> shared_exports;
+
+// Scene buffers off program for longer than idle_buffer_seconds are dropped,
+// or trimmed to their newest IDLE_TRIM_SECONDS. 0 keeps them forever.
+enum class IdlePolicy { Drop, Trim };
+static const int IDLE_TRIM_SECONDS = 10;
+static std::atomic<int> idle_buffer_seconds{300};
+static std::atomic<IdlePolicy> idle_policy{IdlePolicy::Drop};
+
+// Disk tier: raw video older than spill_hot_seconds moves to a memory mapped
+// file per buffer under spill_directory, which is set once at load
+static std::atomic<bool> spill_enabled{false};
+static std::atomic<int> spill_hot_seconds{10};
+static std::string spill_directory;
 static std::string output_directory;
+// Replay players, each with its own scene and source. The first keeps the
+// names of earlier versions; the rest are numbered from 2.
+static const size_t MAX_REPLAY_PLAYERS = 4;
 static const char *REPLAY_SCENE_NAME = "Replay";
 static const char *REPLAY_SOURCE_NAME = "ReplaySource";
-static std::string previous_scene_name;
+// Only scenes in the active group are buffered; no active group buffers
+// every scene. Both are guarded by buffer_mutex.
 static std::string current_group;
 static std::map<std::string, std::vector<std::string>> scene_groups; // Group to scene mapping
+
+// Scenes kept current by the global source signals, so nothing has to walk
+// every source. Guarded by buffer_mutex.
+static std::set<std::string> known_scenes;
 static std::deque<std::string> error_log;
+static std::mutex error_log_mutex;
 static const size_t max_errors = 10;
-static obs_source_t *replay_source = nullptr;
+
+static std::atomic<bool> preroll_enabled{true};
+static obs_websocket_vendor websocket_vendor = nullptr;
+
+// Encoded buffer mode
+static const char *PACKET_OUTPUT_ID = "replay_packet_output";
+static const int ENCODED_VIDEO_BITRATE = 6000; // kbps
+static const int ENCODED_AUDIO_BITRATE = 160;  // kbps
+static obs_output_t *packet_output = nullptr;
+static obs_encoder_t *replay_video_encoder = nullptr;
+static obs_encoder_t *replay_audio_encoder = nullptr;
+
+// Stream parameters needed to remux the packet rings, captured once the
+// encoders have produced their first keyframe
+struct PacketStreamInfo {
+	std::string video_codec;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint8_t> video_extra_data;
+	std::string audio_codec;
+	uint32_t sample_rate = 0;
+	size_t channels = 0;
+	std::vector<uint8_t> audio_extra_data;
+};
+static std::shared_ptr<const PacketStreamInfo> packet_stream_info;
+
+// Buffer and output layout the capture callbacks write into. Rebuilt on
+// scene change and video reset so the video thread never has to look up the
+// current scene or the output info.
+struct CaptureTarget {
+	std::string scene_name;
+	std::shared_ptr<FrameBuffer> buffer;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	enum video_format format = VIDEO_FORMAT_NONE;
+};
+static std::shared_ptr<const CaptureTarget> capture_target;
 
 // Add these near the top with other global variables
-static std::set<obs_source_t*> monitored_sources;
 static void set_plugin_enabled(bool enabled);
+static void set_buffer_mode(BufferMode mode);
+static void save_buffer_settings();
+static void refresh_capture_target();
 static void stop_video_capture();
 static void stop_audio_capture();
+static void packet_output_encoded_packet(void *data, struct encoder_packet *packet);
+bool start_encoded_capture();
+void stop_encoded_capture();
+static void update_encoded_capture();
 
 // Define the source info structure
-static struct obs_source_info replay_source_info = {.id = "replay_capture",
+static struct obs_source_info replay_filter_info = {.id = "replay_capture",
 						    .type = OBS_SOURCE_TYPE_FILTER,
-						    .output_flags = OBS_SOURCE_VIDEO,
+						    .output_flags = OBS_SOURCE_VIDEO | OBS_SOURCE_ASYNC,
 						    .get_name = [](void *) -> const char * { return "Replay Capture"; },
-						    .create = [](obs_data_t *settings, obs_source_t *source) -> void * {
+						    .create = replay_filter_create,
+						    .destroy = replay_filter_destroy,
+						    .filter_video = replay_filter_video,
+						    .filter_remove = replay_filter_remove,
+						    .filter_add = replay_filter_add};
+
+// Draws replays itself, pulling frames from the ring on the render thread
+static struct obs_source_info replay_source_info = {.id = "replay_player_source",
+						    .type = OBS_SOURCE_TYPE_INPUT,
+						    .output_flags = OBS_SOURCE_VIDEO | OBS_SOURCE_AUDIO | OBS_SOURCE_CUSTOM_DRAW |
+								    OBS_SOURCE_DO_NOT_DUPLICATE,
+						    .get_name = [](void *) -> const char * { return "Replay Player"; },
+						    .create = replay_source_create,
+						    .destroy = replay_source_destroy,
+						    .get_width = replay_source_get_width,
+						    .get_height = replay_source_get_height,
+						    .video_tick = replay_source_tick,
+						    .video_render = replay_source_render,
+						    .enum_active_sources = replay_source_enum_sources};
+
+// Encoded-only output that feeds packets into the per-scene rings
+static bool packet_output_start(void *data)
+{
+	obs_output_t *output = static_cast<obs_output_t *>(data);
+	if (!obs_output_can_begin_data_capture(output, 0))
+		return false;
+	if (!obs_output_initialize_encoders(output, 0))
+		return false;
+	return obs_output_begin_data_capture(output, 0);
+}
+
+static void packet_output_stop(void *data, uint64_t ts)
+{
+	UNUSED_PARAMETER(ts);
+	obs_output_end_data_capture(static_cast<obs_output_t *>(data));
+}
+
+static struct obs_output_info packet_output_info = {.id = PACKET_OUTPUT_ID,
+						    .flags = OBS_OUTPUT_AV | OBS_OUTPUT_ENCODED,
+						    .get_name = [](void *) -> const char * { return "Replay Packet Buffer"; },
+						    .create = [](obs_data_t *settings, obs_output_t *output) -> void * {
 							    UNUSED_PARAMETER(settings);
-							    return source;
+							    return output;
 						    },
-						    .destroy = replay_source_destroy,
-						    .video_render = replay_source_render};
+						    .destroy = [](void *data) { UNUSED_PARAMETER(data); },
+						    .start = packet_output_start,
+						    .stop = packet_output_stop,
+						    .encoded_packet = packet_output_encoded_packet};
+
+// Background writer for the plugin's own log lines. Callers hand it a
+// message and return; the blog() call and its formatting happen here. It
+// also turns the capture counters into one summary line per interval.
+struct LogWorker {
+	static const size_t max_pending = 256;
+	static constexpr int summary_seconds = 60;
+
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<std::string> pending; // LOG_ERROR lines, oldest first
+	size_t dropped = 0;              // Lines lost to a full queue since the last write
+	bool running = false;
+
+	uint64_t last_events[(size_t)CaptureEvent::Count] = {};
+
+	void start() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (running)
+			return;
+		running = true;
+		worker = std::thread(&LogWorker::run, this);
+	}
+
+	// Writes out whatever is still queued before returning
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!running)
+				return;
+			running = false;
+		}
+		wake.notify_all();
+		if (worker.joinable())
+			worker.join();
+	}
+
+	// Queue an error line. Without the worker it is written right away.
+	void post(const std::string &message) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (running) {
+				if (pending.size() >= max_pending)
+					dropped++;
+				else
+					pending.push_back(message);
+				wake.notify_one();
+				return;
+			}
+		}
+		blog(LOG_ERROR, "%s", message.c_str());
+	}
+
+	// The caller holds no lock
+	void write(std::deque<std::string> &lines, size_t lost) {
+		// Runs of the same message become one line
+		for (size_t i = 0; i < lines.size();) {
+			size_t repeats = 1;
+			while (i + repeats < lines.size() && lines[i + repeats] == lines[i])
+				repeats++;
+			if (repeats > 1)
+				blog(LOG_ERROR, "%s (repeated %zu times)", lines[i].c_str(), repeats);
+			else
+				blog(LOG_ERROR, "%s", lines[i].c_str());
+			i += repeats;
+		}
+		if (lost > 0)
+			blog(LOG_WARNING, "Replay plugin dropped %zu log lines", lost);
+	}
+
+	// One line with what the capture paths did since the last summary;
+	// nothing if they were idle
+	void summarize() {
+		uint64_t delta[(size_t)CaptureEvent::Count];
+		bool any = false;
+		for (size_t i = 0; i < (size_t)CaptureEvent::Count; i++) {
+			uint64_t total = capture_events[i].load(std::memory_order_relaxed);
+			delta[i] = total - last_events[i];
+			last_events[i] = total;
+			any = any || delta[i] > 0;
+		}
+		if (!any)
+			return;
+
+		auto get = [&](CaptureEvent event) { return (unsigned long long)delta[(size_t)event]; };
+		int level = get(CaptureEvent::SlotFailure) > 0 ? LOG_WARNING : LOG_INFO;
+		blog(level,
+		     "Replay capture since last summary: %llu video frames, %llu skipped, %llu rejected, "
+		     "%llu slot failures, %llu evicted, %llu thinned, %llu textures, %llu audio chunks, %llu packets",
+		     get(CaptureEvent::VideoFrame), get(CaptureEvent::VideoSkipped),
+		     get(CaptureEvent::VideoRejected), get(CaptureEvent::SlotFailure), get(CaptureEvent::VideoEvicted),
+		     get(CaptureEvent::VideoThinned), get(CaptureEvent::TextureFrame), get(CaptureEvent::AudioChunk),
+		     get(CaptureEvent::Packet));
+	}
+
+	void run() {
+		auto next_summary = std::chrono::steady_clock::now() + std::chrono::seconds(summary_seconds);
+		std::unique_lock<std::mutex> lock(mutex);
+		for (;;) {
+			wake.wait_until(lock, next_summary, [this] { return !running || !pending.empty(); });
+
+			std::deque<std::string> lines;
+			lines.swap(pending);
+			size_t lost = dropped;
+			dropped = 0;
+			bool stopping = !running;
+			lock.unlock();
+
+			write(lines, lost);
+			if (stopping || std::chrono::steady_clock::now() >= next_summary) {
+				summarize();
+				next_summary = std::chrono::steady_clock::now() + std::chrono::seconds(summary_seconds);
+			}
+
+			lock.lock();
+			if (stopping && pending.empty())
+				break;
+		}
+	}
+};
+static LogWorker log_worker;
 
-// Helper Function: Add error to log
+// Helper Function: Add error to log. Only takes the log locks, never a
+// buffer lock, and the write itself happens on the log worker.
 void log_error(const std::string &message)
 {
-	blog(LOG_ERROR, "%s", message.c_str());
-	std::lock_guard<std::mutex> lock(buffer_mutex);
+	log_worker.post(message);
+	std::lock_guard<std::mutex> lock(error_log_mutex);
 	if (error_log.size() >= max_errors) {
 		error_log.pop_front();
 	}
@@ -211,7 +419,7 @@ void log_error(const std::string &message)
 // Helper Function: Generate error text
 std::string get_error_log_text()
 {
-	std::lock_guard<std::mutex> lock(buffer_mutex);
+	std::lock_guard<std::mutex> lock(error_log_mutex);
 	std::string error_text;
 	for (const auto &error : error_log) {
 		error_text += "[ERROR] " + error + "\n";
@@ -219,555 +427,3997 @@ std::string get_error_log_text()
 	return error_text;
 }
 
-void release_replay_source()
+static std::string get_player_scene_name(size_t index)
 {
-	if (replay_source) {
-		blog(LOG_INFO, "Releasing replay source.");
-
-		// Find the replay source in any scenes and remove it
-		enumerate_sources([](obs_source_t *source) {
-			if (obs_source_get_type(source) == OBS_SOURCE_TYPE_SCENE) {
-				obs_scene_t *scene = obs_scene_from_source(source);
-				obs_sceneitem_t *item = obs_scene_find_source(scene, REPLAY_SOURCE_NAME);
-				if (item) {
-					obs_sceneitem_remove(item);
-				}
-			}
-		});
+	return index == 0 ? REPLAY_SCENE_NAME : std::string(REPLAY_SCENE_NAME) + " " + std::to_string(index + 1);
+}
 
-		obs_source_release(replay_source);
-		replay_source = nullptr;
-	}
+static std::string get_player_source_name(size_t index)
+{
+	return index == 0 ? REPLAY_SOURCE_NAME : std::string(REPLAY_SOURCE_NAME) + " " + std::to_string(index + 1);
 }
 
-// Ensure scene buffers are cleared
-void clear_scene_buffers()
+static bool is_replay_scene(const std::string &scene_name)
 {
-	std::lock_guard<std::mutex> lock(buffer_mutex);
-	for (auto &buffer : scene_buffers) {
-		buffer.second.clear();
+	for (size_t i = 0; i < MAX_REPLAY_PLAYERS; i++) {
+		if (scene_name == get_player_scene_name(i))
+			return true;
 	}
-	scene_buffers.clear();
+	return false;
 }
 
-// Helper function to enumerate sources
-void enumerate_sources(std::function<void(obs_source_t *)> callback)
-{
-	auto enum_proc = [](void *param, obs_source_t *source) -> bool {
-		auto cb = static_cast<std::function<void(obs_source_t *)> *>(param);
-		(*cb)(source);
-		return true;
+static void enforce_memory_budget();
+
+// Background thread that frees detached history. A full buffer can hold
+// gigabytes, and disabling the plugin or dropping a scene must not free
+// them on the UI thread. It also evicts across buffers when capture runs
+// over the memory budget, so the video thread never takes the map lock.
+struct ReclaimWorker {
+	struct Reclaim {
+		std::shared_ptr<FrameBuffer> buffer;
+		bool clear; // Empty a buffer that stays registered, not just drop the reference
+		std::shared_ptr<const void> memory; // Or history already cut out of a buffer
 	};
 
-	std::function<void(obs_source_t *)> cb = callback;
-	obs_enum_sources(enum_proc, &cb);
-}
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<Reclaim> pending;
+	bool running = false;
+	bool stopped = false; // After unload, frees happen inline
+	std::atomic<bool> over_budget{false};
+
+	void start() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (running || stopped)
+			return;
+		running = true;
+		worker = std::thread(&ReclaimWorker::run, this);
+	}
 
-// Update scene buffers based on the active group
-void update_scene_buffers()
-{
-	if (!plugin_enabled)
-		return;
+	// From the capture threads. Only the first request of a round takes the
+	// worker's own mutex, so the wakeup cannot be lost.
+	void request_budget() {
+		if (over_budget.exchange(true))
+			return;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+		}
+		wake.notify_one();
+	}
+
+	void release(std::shared_ptr<FrameBuffer> buffer, bool clear = false) {
+		if (buffer)
+			queue({std::move(buffer), clear, nullptr});
+	}
 
-	std::lock_guard<std::mutex> lock(buffer_mutex);
-	scene_buffers.clear();
+	void release_memory(std::shared_ptr<const void> memory) {
+		if (memory)
+			queue({nullptr, false, std::move(memory)});
+	}
 
-	blog(LOG_INFO, "Updating scene buffers...");
-	enumerate_sources([](obs_source_t *source) {
-		if (obs_source_get_type(source) == OBS_SOURCE_TYPE_SCENE) {
-			const char *scene_name = obs_source_get_name(source);
-			if (scene_name) {
-				scene_buffers[scene_name] = FrameBuffer(30, 60); // 30 seconds at 60 FPS
-				blog(LOG_INFO, "Created buffer for scene: %s", scene_name);
+	void queue(Reclaim task) {
+		bool queued = false;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!stopped) {
+				if (!running) {
+					running = true;
+					worker = std::thread(&ReclaimWorker::run, this);
+				}
+				pending.push_back(std::move(task));
+				queued = true;
 			}
 		}
-	});
-}
-
-// Set active group and update buffers
-void set_active_group(const std::string &group_name)
-{
-	if (scene_groups.find(group_name) != scene_groups.end()) {
-		current_group = group_name;
-		update_scene_buffers();
-	} else {
-		log_error("Group not found: " + group_name);
+		if (queued)
+			wake.notify_one();
+		else
+			reclaim(std::move(task));
 	}
-}
 
-// Capture audio frames
-void capture_audio_frames(obs_source_t *source, obs_source_audio *audio)
-{
-	if (!plugin_enabled)
-		return;
+	// Frees whatever is still queued, then joins the thread
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopped = true;
+			running = false;
+		}
+		wake.notify_all();
+		if (worker.joinable())
+			worker.join();
+	}
 
-	const char *source_name = obs_source_get_name(source);
-	blog(LOG_INFO, "Capturing audio for source: %s", source_name);
+	void run() {
+		std::unique_lock<std::mutex> lock(mutex);
+		for (;;) {
+			wake.wait(lock, [this] { return !running || !pending.empty() || over_budget; });
+			if (over_budget.exchange(false)) {
+				lock.unlock();
+				enforce_memory_budget();
+				lock.lock();
+				continue;
+			}
+			if (pending.empty())
+				return;
+
+			Reclaim task = std::move(pending.front());
+			pending.pop_front();
+			lock.unlock();
+			reclaim(std::move(task));
+			lock.lock();
+		}
+	}
 
-	auto it = scene_buffers.find(source_name);
-	if (it != scene_buffers.end()) {
-		it->second.add_audio_frame(std::make_shared<obs_source_audio>(*audio));
+	static void reclaim(Reclaim task) {
+		if (task.clear)
+			task.buffer->clear();
+		task.buffer.reset();
+		task.memory.reset();
 	}
-}
+};
 
-// Start capturing audio
-void start_audio_capture()
+static ReclaimWorker reclaim_worker;
+
+static void request_memory_reclaim()
 {
-	blog(LOG_INFO, "Starting audio capture...");
-	
-	enumerate_sources([](obs_source_t *source) {
-		uint32_t caps = obs_source_get_output_flags(source);
-		if (caps & OBS_SOURCE_AUDIO) {
-			const char *source_name = obs_source_get_name(source);
-			if (source_name && strcmp(source_name, REPLAY_SOURCE_NAME) != 0) {
-				// Add audio callback
-				obs_source_add_audio_capture_callback(source, audio_callback, nullptr);
-				blog(LOG_INFO, "Added audio capture callback to source: %s", source_name);
-			}
-		}
-	});
+	reclaim_worker.request_budget();
 }
 
-// Updated audio_callback implementation
-void audio_callback(void *param, obs_source_t *source, const audio_data *audio, bool muted)
+// Ensure scene buffers are cleared. The frees happen on the reclaim worker.
+void clear_scene_buffers()
 {
-	(void)param; // Suppress unused parameter warning
+	std::atomic_store(&capture_target, std::shared_ptr<const CaptureTarget>());
 
-	if (!plugin_enabled || muted || !audio)
-		return;
-
-	const char *source_name = obs_source_get_name(source);
-	std::lock_guard<std::mutex> lock(buffer_mutex);
-	auto it = scene_buffers.find(source_name);
-	if (it != scene_buffers.end()) {
-		auto audio_frame = std::make_shared<obs_source_audio>();
-		audio_frame->frames = audio->frames;
-
-		// Copy audio data
-		for (size_t i = 0; i < MAX_AV_PLANES; ++i) {
-			if (audio->data[i]) {
-				size_t plane_size = audio->frames * sizeof(float);
-				uint8_t *dest = static_cast<uint8_t *>(malloc(plane_size));
-				if (dest != nullptr) {
-					std::memcpy(dest, audio->data[i], plane_size);
-					audio_frame->data[i] = dest;
-				} else {
-					audio_frame->data[i] = nullptr;
-				}
-			} else {
-				audio_frame->data[i] = nullptr;
-			}
-		}
+	std::map<std::string, std::shared_ptr<FrameBuffer>> buffers;
+	{
+		BufferMapLock lock;
+		buffers.swap(scene_buffers);
+	}
+	for (auto &buffer : buffers)
+		reclaim_worker.release(std::move(buffer.second), true);
 
-		it->second.add_audio_frame(audio_frame); // Add to buffer
-		blog(LOG_INFO, "Captured audio frame for source: %s", source_name);
+	// Source buffers stay registered with their filters; only the history goes
+	buffers.clear();
+	{
+		BufferMapLock lock;
+		buffers = source_buffers;
 	}
+	for (auto &buffer : buffers)
+		reclaim_worker.release(std::move(buffer.second), true);
 }
 
-// Update the callback signature to match the correct type
-static void raw_video_callback(void *param, struct video_data *frame)
+// Copy of the buffer table, so callers can walk it without the map lock
+static std::map<std::string, std::shared_ptr<FrameBuffer>> get_all_buffers()
 {
-    UNUSED_PARAMETER(param);
-
-    if (!plugin_enabled) {
-        blog(LOG_DEBUG, "Plugin is disabled, skipping video callback");
-        return;
-    }
+	BufferMapLock lock;
+	return scene_buffers;
+}
 
-    if (!frame) {
-        blog(LOG_WARNING, "Received null frame in video callback");
-        return;
-    }
+// Look up a scene's buffer; the map lock is only held for the lookup
+static std::shared_ptr<FrameBuffer> find_buffer(const std::string &scene_name)
+{
+	BufferMapLock lock;
+	auto it = scene_buffers.find(scene_name);
+	return it != scene_buffers.end() ? it->second : nullptr;
+}
 
-    blog(LOG_DEBUG, "Raw video callback received frame with timestamp: %llu", frame->timestamp);
+// Buffer of a source carrying a replay_capture filter
+static std::shared_ptr<FrameBuffer> find_source_buffer(const std::string &source_name)
+{
+	BufferMapLock lock;
+	auto it = source_buffers.find(source_name);
+	return it != source_buffers.end() ? it->second : nullptr;
+}
 
-    // Get current scene
-    obs_source_t *current_scene = obs_frontend_get_current_scene();
-    if (!current_scene) {
-        blog(LOG_WARNING, "No current scene available");
-        return;
-    }
+static std::map<std::string, std::shared_ptr<FrameBuffer>> get_all_source_buffers()
+{
+	BufferMapLock lock;
+	return source_buffers;
+}
 
-    const char *scene_name = obs_source_get_name(current_scene);
-    if (!scene_name) {
-        blog(LOG_WARNING, "Could not get scene name");
-        obs_source_release(current_scene);
-        return;
-    }
+// Configured history for a scene or source. The caller holds buffer_mutex.
+static int get_buffer_seconds(const std::string &name)
+{
+	auto it = buffer_durations.find(name);
+	return it != buffer_durations.end() ? it->second : default_buffer_seconds.load();
+}
 
-    blog(LOG_DEBUG, "Processing frame for scene: %s", scene_name);
+// The caller holds buffer_mutex
+static CaptureProfile get_capture_profile(const std::string &name)
+{
+	auto it = capture_profiles.find(name);
+	return it != capture_profiles.end() ? it->second : CaptureProfile();
+}
 
-    // Get video output info with more detailed logging
-    video_t *video = obs_get_video();
-    if (!video) {
-        blog(LOG_ERROR, "Failed to get video context");
-        obs_source_release(current_scene);
-        return;
-    }
+static const char *get_capture_scale_name(uint32_t divisor)
+{
+	return divisor == 4 ? "quarter" : divisor == 2 ? "half" : "full";
+}
 
-    const struct video_output_info *voi = video_output_get_info(video);
-    if (!voi) {
-        blog(LOG_ERROR, "Failed to get video output info");
-        obs_source_release(current_scene);
-        return;
-    }
+static bool parse_capture_scale(const char *name, uint32_t &divisor)
+{
+	for (uint32_t candidate : {1u, 2u, 4u}) {
+		if (strcmp(name, get_capture_scale_name(candidate)) == 0) {
+			divisor = candidate;
+			return true;
+		}
+	}
+	return false;
+}
 
-    blog(LOG_DEBUG, "Video info - Width: %d, Height: %d, Format: %d", 
-        voi->width, voi->height, voi->format);
+static void get_output_fps(uint32_t &fps_num, uint32_t &fps_den)
+{
+	video_t *video = obs_get_video();
+	const struct video_output_info *voi = video ? video_output_get_info(video) : nullptr;
+	fps_num = voi ? voi->fps_num : 60;
+	fps_den = voi ? voi->fps_den : 1;
+}
 
-    std::lock_guard<std::mutex> lock(buffer_mutex);
-    auto it = scene_buffers.find(scene_name);
-    if (it == scene_buffers.end()) {
-        blog(LOG_DEBUG, "Creating new buffer for scene: %s", scene_name);
-        scene_buffers[scene_name] = FrameBuffer(30, 60); // 30 seconds at 60 FPS
-        it = scene_buffers.find(scene_name);
-    }
+// Name other processes open a buffer's shared ring by: the scene or source
+// name with anything but letters, digits, '-' and '_' replaced
+static std::string get_shared_ring_name(const std::string &name)
+{
+	std::string safe_name;
+	for (char c : name)
+		safe_name += isalnum((unsigned char)c) || c == '-' || c == '_' ? c : '_';
+#ifdef __APPLE__
+	safe_name.resize(std::min<size_t>(safe_name.size(), 19)); // Shared memory names stop at 31 bytes
+#endif
+#ifdef _WIN32
+	return "Local\\obs-replay-" + safe_name;
+#else
+	return "/obs-replay-" + safe_name;
+#endif
+}
 
-    // Create and populate the video frame
-    auto video_frame = std::make_shared<obs_source_frame>();
-    video_frame->width = voi->width;
-    video_frame->height = voi->height;
-    video_frame->format = voi->format;
-    video_frame->timestamp = frame->timestamp;
-
-    // Calculate sizes for each plane
-    size_t plane_sizes[MAX_AV_PLANES] = {0};
-    for (size_t i = 0; i < MAX_AV_PLANES; i++) {
-        if (frame->linesize[i] > 0) {
-            plane_sizes[i] = frame->linesize[i] * voi->height;
-            if (i > 0 && voi->format == VIDEO_FORMAT_I420) {
-                plane_sizes[i] = plane_sizes[i] / 2; // UV planes are quarter size
-            }
-        }
-    }
+// Set up or stop the shared export of one buffer. The caller holds
+// buffer_mutex.
+static void apply_shared_export(const std::string &name, FrameBuffer &buffer)
+{
+	auto it = shared_exports.find(name);
+	buffer.set_shared_export(get_shared_ring_name(name), it != shared_exports.end() ? it->second : 0);
+}
 
-    // Copy frame data
-    bool copy_success = true;
-    for (size_t i = 0; i < MAX_AV_PLANES; i++) {
-        if (frame->data[i] && plane_sizes[i] > 0) {
-            video_frame->data[i] = (uint8_t *)bmemdup(frame->data[i], plane_sizes[i]);
-            video_frame->linesize[i] = frame->linesize[i];
-            
-            if (!video_frame->data[i]) {
-                blog(LOG_ERROR, "Failed to allocate memory for plane %zu", i);
-                copy_success = false;
-                break;
-            }
-        } else {
-            video_frame->data[i] = nullptr;
-            video_frame->linesize[i] = 0;
-        }
-    }
+// New buffer sized for the output frame rate. The caller holds buffer_mutex.
+static std::shared_ptr<FrameBuffer> make_buffer(const std::string &name)
+{
+	uint32_t fps_num, fps_den;
+	get_output_fps(fps_num, fps_den);
+	auto buffer = std::make_shared<FrameBuffer>(get_buffer_seconds(name), fps_num, fps_den);
+	buffer->set_profile(get_capture_profile(name), fps_num, fps_den);
+	if (shared_exports.count(name))
+		apply_shared_export(name, *buffer);
+	return buffer;
+}
 
-    if (copy_success) {
-        it->second.add_video_frame(video_frame);
-        blog(LOG_DEBUG, "Successfully added frame to buffer for scene '%s' (Buffer size: %zu)", 
-            scene_name, it->second.video_frames.size());
-    } else {
-        // Clean up on failure
-        for (size_t i = 0; i < MAX_AV_PLANES; i++) {
-            if (video_frame->data[i]) {
-                bfree(video_frame->data[i]);
-            }
-        }
-    }
+// Push the configured durations and profiles and the current frame rate to
+// every buffer
+static void apply_buffer_durations()
+{
+	uint32_t fps_num, fps_den;
+	get_output_fps(fps_num, fps_den);
 
-    obs_source_release(current_scene);
+	// A profile change releases texture slots, so it runs without the map
+	// lock. History cut by a shorter duration is freed by the reclaim worker.
+	std::vector<std::pair<std::shared_ptr<FrameBuffer>, CaptureProfile>> profiles;
+	auto trimmed = std::make_shared<std::vector<std::shared_ptr<const void>>>();
+	{
+		BufferMapLock lock;
+		for (auto *buffers : {&scene_buffers, &source_buffers}) {
+			for (auto &buffer : *buffers) {
+				size_t seconds = get_buffer_seconds(buffer.first);
+				buffer.second->set_duration(seconds, fps_num, fps_den, *trimmed);
+				profiles.emplace_back(buffer.second, get_capture_profile(buffer.first));
+			}
+		}
+	}
+	if (!trimmed->empty())
+		reclaim_worker.release_memory(std::move(trimmed));
+	for (auto &profile : profiles)
+		profile.first->set_profile(profile.second, fps_num, fps_den);
 }
 
-
-void start_video_capture()
+// Over budget: evict the oldest second from whichever buffer holds the most
+// video per second of configured history, until the total fits again. Long
+// histories keep proportionally more than short ones.
+static void enforce_memory_budget()
 {
-    blog(LOG_INFO, "Starting video capture...");
-    
-    // Get current video context and info for validation
-    video_t *video = obs_get_video();
-    if (!video) {
-        blog(LOG_ERROR, "Failed to get video context when starting capture");
-        return;
-    }
+	std::vector<std::shared_ptr<FrameBuffer>> buffers;
+	{
+		BufferMapLock lock;
+		for (auto *map : {&scene_buffers, &source_buffers}) {
+			for (auto &buffer : *map)
+				buffers.push_back(buffer.second);
+		}
+	}
 
-    const struct video_output_info *voi = video_output_get_info(video);
-    if (!voi) {
-        blog(LOG_ERROR, "Failed to get video output info when starting capture");
-        return;
-    }
+	const uint64_t budget = get_memory_budget_bytes();
+	while (buffered_video_bytes > budget) {
+		std::shared_ptr<FrameBuffer> victim;
+		uint64_t victim_rate = 0;
+		for (auto &buffer : buffers) {
+			uint64_t rate = buffer->video_bytes_per_second();
+			if (rate > victim_rate) {
+				victim = buffer;
+				victim_rate = rate;
+			}
+		}
 
-    blog(LOG_INFO, "Video capture starting with resolution %dx%d", voi->width, voi->height);
-    obs_add_raw_video_callback(NULL, raw_video_callback, NULL);
-    blog(LOG_INFO, "Raw video callback registered successfully");
+		if (!victim || !victim->evict_oldest_segment()) {
+			// Nothing left but open segments
+			buffers.erase(std::remove(buffers.begin(), buffers.end(), victim), buffers.end());
+			if (!victim || buffers.empty())
+				break;
+		}
+	}
 }
 
-void stop_video_capture()
+static const char *get_idle_policy_name(IdlePolicy policy)
 {
-	blog(LOG_INFO, "Stopping video capture...");
-	obs_remove_raw_video_callback(raw_video_callback, nullptr);
+	return policy == IdlePolicy::Trim ? "trim" : "drop";
 }
 
-void video_render_callback(void *param, obs_source_t *source, const struct video_data *frame)
+// Apply the idle policy to scene buffers that have been off program too
+// long. Runs on the save pool so large frees stay off the graphics thread.
+static void age_idle_buffers()
 {
-	UNUSED_PARAMETER(param);
-	
-	if (!plugin_enabled || !frame || !source)
+	const int idle_seconds = idle_buffer_seconds;
+	if (idle_seconds <= 0)
 		return;
 
-	const char *source_name = obs_source_get_name(source);
-	if (!source_name) return;
+	const uint64_t now = os_gettime_ns();
+	const uint64_t idle_ns = (uint64_t)idle_seconds * 1000000000ULL;
+	const IdlePolicy policy = idle_policy;
 
-	blog(LOG_DEBUG, "Capturing frame from source: %s", source_name);
+	// Dropped buffers are freed after the map lock is released
+	std::vector<std::shared_ptr<FrameBuffer>> expired;
+	{
+		BufferMapLock lock;
+		for (auto it = scene_buffers.begin(); it != scene_buffers.end();) {
+			uint64_t idle_since = it->second->idle_since;
+			if (!idle_since || now - idle_since < idle_ns) {
+				++it;
+				continue;
+			}
 
-	std::lock_guard<std::mutex> lock(buffer_mutex);
-	auto it = scene_buffers.find(source_name);
-	if (it != scene_buffers.end()) {
-		auto video_frame = std::make_shared<obs_source_frame>();
-		
-		// Get source info for dimensions
-		uint32_t width = obs_source_get_width(source);
-		uint32_t height = obs_source_get_height(source);
-		
-		if (width == 0 || height == 0) {
-			blog(LOG_ERROR, "Invalid source dimensions: %dx%d", width, height);
-			return;
+			if (policy == IdlePolicy::Drop) {
+				blog(LOG_INFO, "Dropped buffer for idle scene: %s", it->first.c_str());
+				expired.push_back(std::move(it->second));
+				it = scene_buffers.erase(it);
+			} else {
+				expired.push_back(it->second);
+				++it;
+			}
 		}
+	}
 
-		// Copy frame properties
-		video_frame->width = width;
-		video_frame->height = height;
-		video_frame->timestamp = frame->timestamp;
-		video_frame->format = VIDEO_FORMAT_I420;
-
-		// Calculate proper plane sizes
-		size_t y_size = width * height;
-		size_t u_size = (width/2) * (height/2);
-		size_t v_size = u_size;
-
-		// Allocate and copy data for each plane
-		video_frame->data[0] = (uint8_t *)bmemdup(frame->data[0], y_size);
-		video_frame->data[1] = (uint8_t *)bmemdup(frame->data[1], u_size);
-		video_frame->data[2] = (uint8_t *)bmemdup(frame->data[2], v_size);
-		video_frame->linesize[0] = width;
-		video_frame->linesize[1] = width/2;
-		video_frame->linesize[2] = width/2;
-
-		it->second.add_video_frame(video_frame);
-		blog(LOG_DEBUG, "Added frame to buffer for source: %s (Buffer size: %zu)", 
-			 source_name, it->second.video_frames.size());
+	if (policy == IdlePolicy::Trim) {
+		for (auto &buffer : expired)
+			buffer->trim_to(IDLE_TRIM_SECONDS);
 	}
 }
 
-// Function to create replay scene and source when needed
-bool create_replay_scene_and_source() {
-	// Check if scene already exists
-	obs_source_t *existing_scene = obs_get_source_by_name(REPLAY_SCENE_NAME);
-	if (existing_scene) {
-		obs_source_release(existing_scene);
-		return true;
+// Background thread that moves cold video into the spill files, so capture
+// never waits on the disk
+struct SpillWorker {
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool running = false;
+
+	void start() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (running)
+			return;
+		running = true;
+		worker = std::thread(&SpillWorker::run, this);
 	}
 
-	// Create new scene
-	obs_scene_t *scene = obs_scene_create(REPLAY_SCENE_NAME);
-	if (!scene) {
-		blog(LOG_ERROR, "Failed to create replay scene");
-		return false;
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!running)
+				return;
+			running = false;
+		}
+		wake.notify_all();
+		if (worker.joinable())
+			worker.join();
 	}
 
-	// Create replay source
-	obs_data_t *settings = obs_data_create();
-	obs_source_t *source = obs_source_create("ffmpeg_source", REPLAY_SOURCE_NAME, settings, nullptr);
+	void run() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (running) {
+			// Segments close about once a second
+			wake.wait_for(lock, std::chrono::milliseconds(500));
+			if (!running || !spill_enabled || !plugin_enabled || spill_directory.empty())
+				continue;
+
+			lock.unlock();
+			spill_all();
+			lock.lock();
+		}
+	}
+
+	void spill_all() {
+		std::vector<std::shared_ptr<FrameBuffer>> buffers;
+		{
+			BufferMapLock lock;
+			for (auto *map : {&scene_buffers, &source_buffers}) {
+				for (auto &buffer : *map)
+					buffers.push_back(buffer.second);
+			}
+		}
+
+		const uint64_t hot_ns = (uint64_t)std::max(spill_hot_seconds.load(), 1) * 1000000000ULL;
+		for (auto &buffer : buffers) {
+			while (buffer->spill_oldest_segment(hot_ns, spill_directory))
+				;
+		}
+	}
+};
+
+static SpillWorker spill_worker;
+
+// Whether a scene gets a buffer under the active group. The caller holds
+// buffer_mutex.
+static bool scene_in_active_group(const std::string &scene_name)
+{
+	if (current_group.empty())
+		return true;
+	auto group = scene_groups.find(current_group);
+	if (group == scene_groups.end())
+		return true;
+	return std::find(group->second.begin(), group->second.end(), scene_name) != group->second.end();
+}
+
+// Find or create the buffer for a scene. The caller holds buffer_mutex.
+static std::shared_ptr<FrameBuffer> get_or_create_buffer(const std::string &scene_name)
+{
+	auto it = scene_buffers.find(scene_name);
+	if (it == scene_buffers.end()) {
+		blog(LOG_DEBUG, "Creating new buffer for scene: %s", scene_name.c_str());
+		it = scene_buffers.emplace(scene_name, make_buffer(scene_name)).first;
+	}
+	return it->second;
+}
+
+// Point the capture callbacks at the current program scene and output layout
+void refresh_capture_target()
+{
+	auto target = std::make_shared<CaptureTarget>();
+
+	obs_source_t *current_scene = obs_frontend_get_current_scene();
+	if (current_scene) {
+		const char *scene_name = obs_source_get_name(current_scene);
+		if (scene_name)
+			target->scene_name = scene_name;
+		obs_source_release(current_scene);
+	}
+
+	video_t *video = obs_get_video();
+	const struct video_output_info *voi = video ? video_output_get_info(video) : nullptr;
+	if (voi) {
+		target->width = voi->width;
+		target->height = voi->height;
+		target->format = voi->format;
+	}
+
+	bool buffered = plugin_enabled && !target->scene_name.empty() && voi;
+	if (buffered) {
+		BufferMapLock lock;
+		buffered = scene_in_active_group(target->scene_name);
+		if (buffered)
+			target->buffer = get_or_create_buffer(target->scene_name);
+	}
+
+	if (!buffered) {
+		std::shared_ptr<const CaptureTarget> previous =
+			std::atomic_exchange(&capture_target, std::shared_ptr<const CaptureTarget>());
+		if (previous && previous->buffer)
+			previous->buffer->idle_since = os_gettime_ns();
+		return;
+	}
+	target->buffer->configure(target->width, target->height, target->format);
+
+	blog(LOG_INFO, "Capture target set to scene '%s' (%ux%u)", target->scene_name.c_str(), target->width,
+	     target->height);
+	target->buffer->idle_since = 0;
+	std::shared_ptr<const CaptureTarget> previous =
+		std::atomic_exchange(&capture_target, std::shared_ptr<const CaptureTarget>(target));
+	if (previous && previous->buffer && previous->buffer != target->buffer)
+		previous->buffer->idle_since = os_gettime_ns();
+
+	// VRAM is too scarce to keep texture history for scenes off program.
+	// Switching to the replay scene keeps it, since that is what plays next.
+	if (buffer_mode == BufferMode::Texture && previous && previous->buffer && previous->buffer != target->buffer &&
+	    !is_replay_scene(target->scene_name))
+		previous->buffer->release_textures();
+}
+
+// Drop the buffers of scenes that no longer exist or have left the active
+// group. Scenes that stay keep their history. Buffers are created lazily,
+// when a scene first goes on program.
+void update_scene_buffers()
+{
+	if (!plugin_enabled)
+		return;
+
+	// Freed by the reclaim worker, after the map lock is released
+	std::vector<std::shared_ptr<FrameBuffer>> removed;
+	{
+		BufferMapLock lock;
+		blog(LOG_INFO, "Updating scene buffers...");
+		for (auto it = scene_buffers.begin(); it != scene_buffers.end();) {
+			bool exists = known_scenes.count(it->first) > 0;
+			if (exists && scene_in_active_group(it->first)) {
+				++it;
+				continue;
+			}
+			blog(LOG_INFO, "Dropped buffer for %s scene: %s", exists ? "ungrouped" : "removed",
+			     it->first.c_str());
+			removed.push_back(std::move(it->second));
+			it = scene_buffers.erase(it);
+		}
+	}
+	for (auto &buffer : removed)
+		reclaim_worker.release(std::move(buffer));
+
+	refresh_capture_target();
+}
+
+// Persist the scene groups and the active group
+static void save_scene_groups()
+{
+	obs_data_t *groups = obs_data_create();
+	std::string active;
+	{
+		BufferMapLock lock;
+		for (auto &group : scene_groups) {
+			obs_data_array_t *scenes = obs_data_array_create();
+			for (auto &scene_name : group.second) {
+				obs_data_t *item = obs_data_create();
+				obs_data_set_string(item, "name", scene_name.c_str());
+				obs_data_array_push_back(scenes, item);
+				obs_data_release(item);
+			}
+			obs_data_set_array(groups, group.first.c_str(), scenes);
+			obs_data_array_release(scenes);
+		}
+		active = current_group;
+	}
+
+	obs_data_t *settings = obs_get_private_data();
+	obs_data_set_obj(settings, "scene_groups", groups);
+	obs_data_set_string(settings, "active_group", active.c_str());
 	obs_data_release(settings);
+	obs_data_release(groups);
+}
+
+// Scene names from an array of {"name": ...} objects
+static std::vector<std::string> get_scene_names(obs_data_array_t *array)
+{
+	std::vector<std::string> names;
+	for (size_t i = 0; array && i < obs_data_array_count(array); i++) {
+		obs_data_t *item = obs_data_array_item(array, i);
+		const char *name = obs_data_get_string(item, "name");
+		if (name && *name && std::find(names.begin(), names.end(), name) == names.end())
+			names.push_back(name);
+		obs_data_release(item);
+	}
+	return names;
+}
+
+static void load_scene_groups(obs_data_t *settings)
+{
+	obs_data_t *groups = obs_data_get_obj(settings, "scene_groups");
+	const char *active = obs_data_get_string(settings, "active_group");
+
+	BufferMapLock lock;
+	if (groups) {
+		for (obs_data_item_t *item = obs_data_first(groups); item; obs_data_item_next(&item)) {
+			obs_data_array_t *scenes = obs_data_item_get_array(item);
+			scene_groups[obs_data_item_get_name(item)] = get_scene_names(scenes);
+			obs_data_array_release(scenes);
+		}
+		obs_data_release(groups);
+	}
+	if (active && scene_groups.count(active))
+		current_group = active;
+}
+
+// Set active group and update buffers. An empty name buffers every scene.
+bool set_active_group(const std::string &group_name)
+{
+	{
+		BufferMapLock lock;
+		if (!group_name.empty() && scene_groups.find(group_name) == scene_groups.end()) {
+			log_error("Group not found: " + group_name);
+			return false;
+		}
+		current_group = group_name;
+	}
+
+	blog(LOG_INFO, "Active scene group set to %s", group_name.empty() ? "(all scenes)" : group_name.c_str());
+	save_scene_groups();
+	update_scene_buffers();
+	return true;
+}
+
+static bool is_tracked_scene(obs_source_t *source)
+{
+	return source && obs_source_get_type(source) == OBS_SOURCE_TYPE_SCENE && !obs_source_is_group(source);
+}
+
+static void on_source_create(void *data, calldata_t *cd)
+{
+	UNUSED_PARAMETER(data);
+	obs_source_t *source = static_cast<obs_source_t *>(calldata_ptr(cd, "source"));
+	const char *name = is_tracked_scene(source) ? obs_source_get_name(source) : nullptr;
+	if (!name)
+		return;
+
+	BufferMapLock lock;
+	known_scenes.insert(name);
+}
+
+static void on_source_destroy(void *data, calldata_t *cd)
+{
+	UNUSED_PARAMETER(data);
+	obs_source_t *source = static_cast<obs_source_t *>(calldata_ptr(cd, "source"));
+	const char *name = is_tracked_scene(source) ? obs_source_get_name(source) : nullptr;
+	if (!name)
+		return;
+
+	// Freed by the reclaim worker, after the map lock is released
+	std::shared_ptr<FrameBuffer> removed;
+	{
+		BufferMapLock lock;
+		known_scenes.erase(name);
+		auto it = scene_buffers.find(name);
+		if (it != scene_buffers.end()) {
+			removed = std::move(it->second);
+			scene_buffers.erase(it);
+		}
+	}
+	if (removed) {
+		blog(LOG_INFO, "Dropped buffer for removed scene: %s", name);
+		reclaim_worker.release(std::move(removed));
+	}
+}
+
+template<typename Map> static bool rename_key(Map &map, const std::string &from, const std::string &to)
+{
+	auto it = map.find(from);
+	if (it == map.end())
+		return false;
+	auto value = std::move(it->second);
+	map.erase(it);
+	map[to] = std::move(value);
+	return true;
+}
+
+// Carry buffers, duration overrides and group membership over to the new
+// name, so nothing stays keyed by the old one
+static void on_source_rename(void *data, calldata_t *cd)
+{
+	UNUSED_PARAMETER(data);
+	obs_source_t *source = static_cast<obs_source_t *>(calldata_ptr(cd, "source"));
+	const char *new_name = calldata_string(cd, "new_name");
+	const char *prev_name = calldata_string(cd, "prev_name");
+	if (!source || !new_name || !prev_name)
+		return;
+
+	bool scene = is_tracked_scene(source);
+	bool settings_changed = false;
+	{
+		BufferMapLock lock;
+		if (scene && known_scenes.erase(prev_name))
+			known_scenes.insert(new_name);
+		rename_key(scene ? scene_buffers : source_buffers, prev_name, new_name);
+		settings_changed = rename_key(buffer_durations, prev_name, new_name);
+		settings_changed = rename_key(capture_profiles, prev_name, new_name) || settings_changed;
+		if (clip_on_leave_scenes.erase(prev_name)) {
+			clip_on_leave_scenes.insert(new_name);
+			settings_changed = true;
+		}
+		// The ring is re-created under the new name
+		if (rename_key(shared_exports, prev_name, new_name)) {
+			auto &buffers = scene ? scene_buffers : source_buffers;
+			auto it = buffers.find(new_name);
+			if (it != buffers.end())
+				apply_shared_export(new_name, *it->second);
+			settings_changed = true;
+		}
+		for (auto &group : scene_groups) {
+			for (auto &scene_name : group.second) {
+				if (scene_name == prev_name) {
+					scene_name = new_name;
+					settings_changed = true;
+				}
+			}
+		}
+	}
+
+	if (settings_changed) {
+		save_scene_groups();
+		save_buffer_settings();
+	}
+	if (scene)
+		refresh_capture_target();
+}
+
+static void connect_source_signals(bool connect)
+{
+	signal_handler_t *handler = obs_get_signal_handler();
+	auto update = connect ? signal_handler_connect : signal_handler_disconnect;
+	update(handler, "source_create", on_source_create, nullptr);
+	update(handler, "source_destroy", on_source_destroy, nullptr);
+	update(handler, "source_rename", on_source_rename, nullptr);
+}
+
+// Program mix into the live scene's ring, alongside its video. Encoded mode
+// records audio through its own encoder instead.
+static void mix_audio_callback(void *param, size_t mix_idx, struct audio_data *data)
+{
+	UNUSED_PARAMETER(param);
+	UNUSED_PARAMETER(mix_idx);
+
+	if (!plugin_enabled || !data || buffer_mode == BufferMode::Encoded)
+		return;
+
+	ScopedLatency latency(replay_stats.audio);
+	std::shared_ptr<const CaptureTarget> target = std::atomic_load(&capture_target);
+	if (target && target->buffer)
+		target->buffer->add_audio(data);
+}
+
+// libobs keeps a duplicate entry for every registration, so the callbacks
+// are attached once and tracked here. Only touched on the UI thread.
+static bool audio_capture_started = false;
+static bool video_capture_started = false;
+
+// Start capturing audio
+void start_audio_capture()
+{
+	if (audio_capture_started)
+		return;
+
+	blog(LOG_INFO, "Starting audio capture...");
+	obs_add_raw_audio_callback(0, nullptr, mix_audio_callback, nullptr);
+	audio_capture_started = true;
+}
+
+// Update the callback signature to match the correct type
+static void raw_video_callback(void *param, struct video_data *frame)
+{
+    UNUSED_PARAMETER(param);
+    ScopedLatency latency(replay_stats.raw_video);
+
+    if (!plugin_enabled)
+        return;
+
+    if (!frame) {
+        count_capture_event(CaptureEvent::VideoRejected);
+        return;
+    }
+
+    // One atomic load; scene and output lookups happen on scene change/reset
+    std::shared_ptr<const CaptureTarget> target = std::atomic_load(&capture_target);
+    if (!target || !target->buffer) {
+        count_capture_event(CaptureEvent::VideoSkipped);
+        return;
+    }
+
+    // The output was reset and the target not rebuilt yet. Frames in the
+    // new layout are dropped until the reset handler has caught up.
+    const struct video_output_info *voi = video_output_get_info(obs_get_video());
+    if (!voi || voi->width != target->width || voi->height != target->height || voi->format != target->format) {
+        count_capture_event(CaptureEvent::VideoRejected);
+        return;
+    }
+
+    // Copy the frame into the scene's slot ring; only that buffer is locked
+    target->buffer->add_video_frame(frame, target->width, target->height, target->format);
+}
+
+
+// Capture profiles in texture mode: draw the program frame into a smaller
+// slot. Runs inside the main render, so all state it changes is restored.
+static void scale_texture(gs_texture_t *target, gs_texture_t *source)
+{
+	uint32_t width = gs_texture_get_width(target);
+	uint32_t height = gs_texture_get_height(target);
+	gs_texture_t *previous_target = gs_get_render_target();
+	gs_zstencil_t *previous_zstencil = gs_get_zstencil_target();
+	bool previous_srgb = gs_framebuffer_srgb_enabled();
+
+	gs_viewport_push();
+	gs_projection_push();
+	gs_matrix_push();
+	gs_matrix_identity();
+	gs_blend_state_push();
+
+	gs_set_render_target(target, nullptr);
+	gs_set_viewport(0, 0, (int)width, (int)height);
+	gs_ortho(0.0f, (float)width, 0.0f, (float)height, -100.0f, 100.0f);
+	gs_enable_blending(false);
+	gs_enable_framebuffer_srgb(false);
+
+	gs_effect_t *effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
+	gs_effect_set_texture(gs_effect_get_param_by_name(effect, "image"), source);
+	while (gs_effect_loop(effect, "Draw"))
+		gs_draw_sprite(source, 0, width, height);
+
+	gs_enable_framebuffer_srgb(previous_srgb);
+	gs_blend_state_pop();
+	gs_matrix_pop();
+	gs_projection_pop();
+	gs_viewport_pop();
+	gs_set_render_target(previous_target, previous_zstencil);
+}
+
+// Texture mode: copy the finished program frame into the live scene's ring.
+// Runs on the graphics thread right after the main texture is rendered.
+static void texture_rendered_callback(void *param)
+{
+	UNUSED_PARAMETER(param);
+	ScopedLatency latency(replay_stats.texture_video);
+
+	if (!plugin_enabled)
+		return;
+
+	std::shared_ptr<const CaptureTarget> target = std::atomic_load(&capture_target);
+	if (!target || !target->buffer)
+		return;
+
+	gs_texture_t *texture = obs_get_main_texture();
+	if (texture)
+		target->buffer->add_texture_frame(texture, obs_get_video_frame_time());
+}
+
+void start_video_capture()
+{
+    if (video_capture_started)
+        return;
+
+    blog(LOG_INFO, "Starting video capture...");
+    
+    // Get current video context and info for validation
+    video_t *video = obs_get_video();
+    if (!video) {
+        blog(LOG_ERROR, "Failed to get video context when starting capture");
+        return;
+    }
+
+    const struct video_output_info *voi = video_output_get_info(video);
+    if (!voi) {
+        blog(LOG_ERROR, "Failed to get video output info when starting capture");
+        return;
+    }
+
+    blog(LOG_INFO, "Video capture starting with resolution %dx%d", voi->width, voi->height);
+
+    // The packet output itself only runs while no video reset can come
+    BufferMode mode = buffer_mode;
+    if (mode == BufferMode::Encoded) {
+        video_capture_started = true;
+        update_encoded_capture();
+        return;
+    }
+
+    if (mode == BufferMode::Texture) {
+        obs_add_main_rendered_callback(texture_rendered_callback, nullptr);
+        video_capture_started = true;
+        blog(LOG_INFO, "Main texture callback registered successfully");
+        return;
+    }
+
+    // Size the slot rings for the current output before the first frame
+    std::vector<std::shared_ptr<FrameBuffer>> buffers;
+    {
+        BufferMapLock lock;
+        for (auto &buffer : scene_buffers) {
+            buffers.push_back(buffer.second);
+        }
+    }
+    for (auto &buffer : buffers) {
+        buffer->configure(voi->width, voi->height, voi->format);
+    }
+
+    obs_add_raw_video_callback(NULL, raw_video_callback, NULL);
+    video_capture_started = true;
+    blog(LOG_INFO, "Raw video callback registered successfully");
+}
+
+void stop_video_capture()
+{
+	if (!video_capture_started)
+		return;
+
+	blog(LOG_INFO, "Stopping video capture...");
+	obs_remove_raw_video_callback(raw_video_callback, nullptr);
+	obs_remove_main_rendered_callback(texture_rendered_callback, nullptr);
+	stop_encoded_capture();
+	video_capture_started = false;
+}
+
+// Prefer a hardware H.264 encoder and fall back to x264
+static const char *find_video_encoder_id()
+{
+	static const char *preferred[] = {"obs_nvenc_h264_tex", "jim_nvenc", "h264_texture_amf", "obs_qsv11_v2",
+					  "com.apple.videotoolbox.videoencoder.ave.avc", "obs_x264"};
+
+	for (const char *wanted : preferred) {
+		const char *id = nullptr;
+		for (size_t idx = 0; obs_enum_encoder_types(idx, &id); idx++) {
+			if (strcmp(id, wanted) == 0)
+				return wanted;
+		}
+	}
+	return "obs_x264";
+}
+
+static void packet_output_encoded_packet(void *data, struct encoder_packet *packet)
+{
+	UNUSED_PARAMETER(data);
+
+	if (!plugin_enabled || !packet)
+		return;
+
+	std::shared_ptr<const CaptureTarget> target = std::atomic_load(&capture_target);
+	if (!target || !target->buffer)
+		return;
+
+	// Encoders are fully initialised once packets flow; grab what the
+	// muxer will need later
+	if (!std::atomic_load(&packet_stream_info) && packet->type == OBS_ENCODER_VIDEO && packet->keyframe) {
+		auto info = std::make_shared<PacketStreamInfo>();
+		uint8_t *extra = nullptr;
+		size_t extra_size = 0;
+
+		info->video_codec = obs_encoder_get_codec(replay_video_encoder);
+		info->width = obs_encoder_get_width(replay_video_encoder);
+		info->height = obs_encoder_get_height(replay_video_encoder);
+		if (obs_encoder_get_extra_data(replay_video_encoder, &extra, &extra_size))
+			info->video_extra_data.assign(extra, extra + extra_size);
+
+		info->audio_codec = obs_encoder_get_codec(replay_audio_encoder);
+		info->sample_rate = obs_encoder_get_sample_rate(replay_audio_encoder);
+		info->channels = audio_output_get_channels(obs_get_audio());
+		if (obs_encoder_get_extra_data(replay_audio_encoder, &extra, &extra_size))
+			info->audio_extra_data.assign(extra, extra + extra_size);
+
+		std::atomic_store(&packet_stream_info, std::shared_ptr<const PacketStreamInfo>(info));
+	}
+
+	target->buffer->add_packet(packet);
+}
+
+static void release_encoders()
+{
+	if (replay_video_encoder) {
+		obs_encoder_release(replay_video_encoder);
+		replay_video_encoder = nullptr;
+	}
+	if (replay_audio_encoder) {
+		obs_encoder_release(replay_audio_encoder);
+		replay_audio_encoder = nullptr;
+	}
+}
+
+// Start the encoder pair and packet output used by the encoded buffer mode
+bool start_encoded_capture()
+{
+	if (packet_output)
+		return true;
+
+	const char *video_encoder_id = find_video_encoder_id();
+	blog(LOG_INFO, "Starting encoded capture with encoder: %s", video_encoder_id);
+
+	obs_data_t *video_settings = obs_data_create();
+	obs_data_set_string(video_settings, "rate_control", "CBR");
+	obs_data_set_int(video_settings, "bitrate", ENCODED_VIDEO_BITRATE);
+	obs_data_set_int(video_settings, "keyint_sec", 1); // Short GOPs keep eviction fine-grained
+	replay_video_encoder = obs_video_encoder_create(video_encoder_id, "replay_video_encoder", video_settings, nullptr);
+	obs_data_release(video_settings);
+
+	obs_data_t *audio_settings = obs_data_create();
+	obs_data_set_int(audio_settings, "bitrate", ENCODED_AUDIO_BITRATE);
+	replay_audio_encoder = obs_audio_encoder_create("ffmpeg_aac", "replay_audio_encoder", audio_settings, 0, nullptr);
+	obs_data_release(audio_settings);
+
+	if (!replay_video_encoder || !replay_audio_encoder) {
+		log_error("Failed to create replay encoders");
+		release_encoders();
+		return false;
+	}
+
+	obs_encoder_set_video(replay_video_encoder, obs_get_video());
+	obs_encoder_set_audio(replay_audio_encoder, obs_get_audio());
+
+	packet_output = obs_output_create(PACKET_OUTPUT_ID, "replay_packet_output", nullptr, nullptr);
+	if (!packet_output) {
+		log_error("Failed to create replay packet output");
+		release_encoders();
+		return false;
+	}
+
+	obs_output_set_video_encoder(packet_output, replay_video_encoder);
+	obs_output_set_audio_encoder(packet_output, replay_audio_encoder, 0);
+
+	if (!obs_output_start(packet_output)) {
+		log_error("Failed to start replay packet output");
+		obs_output_release(packet_output);
+		packet_output = nullptr;
+		release_encoders();
+		return false;
+	}
+
+	blog(LOG_INFO, "Encoded capture started");
+	return true;
+}
+
+void stop_encoded_capture()
+{
+	if (!packet_output)
+		return;
+
+	blog(LOG_INFO, "Stopping encoded capture...");
+	obs_output_stop(packet_output);
+	obs_output_release(packet_output);
+	packet_output = nullptr;
+	release_encoders();
+
+	std::atomic_store(&packet_stream_info, std::shared_ptr<const PacketStreamInfo>());
+}
+
+// libobs refuses to reset video while an output is active, so the packet
+// output is stopped whenever a reset may come: while a profile switch is
+// under way and while the settings dialog is open. Only touched on the UI
+// thread.
+static bool profile_changing = false;
+static bool settings_dialog_open = false;
+
+// Run the packet output exactly when encoded capture should be live. A
+// disabled plugin holds no encoder session, unlike the cheap callbacks.
+static void update_encoded_capture()
+{
+	if (plugin_enabled && video_capture_started && buffer_mode == BufferMode::Encoded && !profile_changing &&
+	    !settings_dialog_open)
+		start_encoded_capture();
+	else
+		stop_encoded_capture();
+}
+
+static void set_reset_hold(bool &hold, bool held)
+{
+	if (hold == held)
+		return;
+	hold = held;
+	update_encoded_capture();
+}
+
+// OBS has no frontend event for its settings dialog, where video settings
+// are applied, so its Show and Hide events are watched on the application
+class SettingsDialogWatcher : public QObject {
+public:
+	using QObject::QObject;
+
+protected:
+	bool eventFilter(QObject *watched, QEvent *event) override
+	{
+		QEvent::Type type = event->type();
+		if ((type == QEvent::Show || type == QEvent::Hide) && watched->isWidgetType() &&
+		    watched->objectName() == "OBSBasicSettings")
+			set_reset_hold(settings_dialog_open, type == QEvent::Show);
+		return QObject::eventFilter(watched, event);
+	}
+};
+
+static SettingsDialogWatcher *settings_watcher = nullptr;
+
+// Switch Scenes
+void switch_to_scene(const std::string &scene_name)
+{
+	obs_source_t *scene = obs_get_source_by_name(scene_name.c_str());
+	if (scene) {
+		obs_frontend_set_current_scene(scene);
+		obs_source_release(scene);
+	} else {
+		log_error("Scene not found: " + scene_name);
+	}
+}
+
+// One entry of a ReplaySequence, sliced and pinned when the sequence is
+// queued so later captures and trimming cannot move or drop its frames
+struct SequenceSegment {
+	std::string scene_name;
+	double speed = 1.0;
+	FrameSnapshot raw;      // Raw frames, or audio only next to textures
+	TextureFrames textures; // GPU copies in texture mode
+	std::vector<std::shared_ptr<encoder_packet>> packets; // Encoded mode
+
+	uint64_t duration_ns() const
+	{
+		uint64_t span = 0;
+		if (!textures.empty())
+			span = textures.back()->timestamp - textures.front()->timestamp;
+		else if (!raw.video.empty())
+			span = raw.video[raw.video.size() - 1].frame.timestamp - raw.video[0].frame.timestamp;
+		else if (!packets.empty())
+			span = (uint64_t)std::max<int64_t>(packets.back()->dts_usec - packets.front()->dts_usec, 0) *
+			       1000;
+		return (uint64_t)(span / speed);
+	}
+};
+
+// What to play from a buffer. A full replay is saved first and plays
+// everything; a ranged one plays only part of the history, right away.
+struct ReplayRequest {
+	std::string scene_name;
+	bool ranged = false;
+	uint64_t from_ns = UINT64_MAX; // Range start, this long before the newest frame
+	uint64_t to_ns = 0;            // Range end, this long before the newest frame
+	double speed = 1.0;
+	bool loop = false;        // Repeat until cancelled or another replay is queued
+	bool switch_scene = true; // Cut the program to the player's scene while it plays
+	uint64_t clip_id = 0;     // Play this clip from the catalog instead of a buffer
+	int64_t clip_offset_ms = 0;
+	std::vector<SequenceSegment> sequence; // Play these back to back instead of one buffer
+
+	// Range bounds as capture timestamps, given the newest one
+	uint64_t start_timestamp(uint64_t newest) const { return !ranged || from_ns >= newest ? 0 : newest - from_ns; }
+	uint64_t end_timestamp(uint64_t newest) const
+	{
+		return !ranged ? UINT64_MAX : to_ns >= newest ? 0 : newest - to_ns;
+	}
+};
+
+struct Playback;
+
+// One long-lived playback worker per replay player. Requests queue up behind
+// the running replay (or pre-empt it) instead of each spawning a thread.
+// Players share the buffers: a snapshot only pins the segments it plays, so
+// two players showing the same scene hold no second copy of its frames.
+struct ReplayPlayer {
+	static const size_t max_queued = 4;
+
+	size_t index = 0;
+	std::string scene_name;
+	std::string source_name;
+
+	// Persistent handle to the player's source, so playback never looks it
+	// up by name. With preroll it is kept showing, so its pipeline is warm
+	// before the program cuts to it. Both are guarded by source_mutex.
+	obs_source_t *source = nullptr;
+	bool source_warm = false;
+	std::mutex source_mutex;
+
+	// What the source shows, read by it with atomic_load
+	std::shared_ptr<const Playback> playback;
+	// An encoded clip is playing through the source's media child
+	std::atomic<bool> clip_playing{false};
+
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<ReplayRequest> queue;
+	bool running = false;
+	std::atomic<bool> cancel_current{false};
+
+	// Worker thread only: whether the program is on the replay scene, and
+	// whether the cut to it waits for the first frame
+	bool in_replay = false;
+	bool switch_pending = false;
+
+	void start(size_t player_index) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (running)
+			return;
+		index = player_index;
+		scene_name = get_player_scene_name(index);
+		source_name = get_player_source_name(index);
+		running = true;
+		cancel_current = false;
+		worker = std::thread(&ReplayPlayer::run, this);
+	}
+
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!running)
+				return;
+			running = false;
+			queue.clear();
+			cancel_current = true;
+		}
+		wake.notify_all();
+		if (worker.joinable())
+			worker.join();
+	}
+
+	// Queue a replay. With preempt the running replay and anything queued
+	// are dropped in its favour. Returns false if the queue is full.
+	bool enqueue(const ReplayRequest &request, bool preempt) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!running)
+				return false;
+			if (preempt) {
+				queue.clear();
+				cancel_current = true;
+			} else if (queue.size() >= max_queued) {
+				return false;
+			}
+			queue.push_back(request);
+		}
+		wake.notify_all();
+		return true;
+	}
+
+	// Called by playback once the first frame is out. With preroll the
+	// program only cuts to the replay scene now, so it never shows an empty
+	// source.
+	void on_first_frame() {
+		if (!switch_pending)
+			return;
+		switch_pending = false;
+		switch_to_scene(scene_name);
+		in_replay = true;
+	}
+
+	// Whether a looping replay goes round again: it hasn't been cancelled
+	// and nothing is waiting behind it
+	bool keep_looping() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return running && !cancel_current && queue.empty();
+	}
+
+	// Stop the running replay and drop everything queued
+	void cancel() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.clear();
+			cancel_current = true;
+		}
+		wake.notify_all();
+	}
+
+	// Sleep until the given os_gettime_ns() deadline. Returns false if the
+	// running replay was cancelled while waiting.
+	bool wait_until_ns(uint64_t deadline) {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (!cancel_current) {
+			uint64_t now = os_gettime_ns();
+			if (now >= deadline)
+				return true;
+			wake.wait_for(lock, std::chrono::nanoseconds(deadline - now));
+		}
+		return false;
+	}
+
+	bool create_scene_and_source();
+	void set_source(obs_source_t *new_source);
+	obs_source_t *get_source();
+	void set_source_warm(bool warm);
+	void release_source(bool remove);
+	void run();
+
+private:
+	void set_source_warm_locked(bool warm);
+};
+
+static ReplayPlayer replay_players[MAX_REPLAY_PLAYERS];
+
+// Return scenes of all players, guarded by return_scene_mutex. A player
+// starting on another player's scene returns to where that one would have.
+static std::mutex return_scene_mutex;
+static std::string return_scenes[MAX_REPLAY_PLAYERS];
+
+static ReplayPlayer *find_player_by_scene(const std::string &scene_name)
+{
+	for (size_t i = 0; i < MAX_REPLAY_PLAYERS; i++) {
+		if (scene_name == get_player_scene_name(i))
+			return &replay_players[i];
+	}
+	return nullptr;
+}
+
+// Player named by a request's 1-based "player", the first if omitted
+static ReplayPlayer *get_request_player(obs_data_t *request_data)
+{
+	if (!obs_data_has_user_value(request_data, "player"))
+		return &replay_players[0];
+	long long number = obs_data_get_int(request_data, "player");
+	if (number < 1 || number > (long long)MAX_REPLAY_PLAYERS)
+		return nullptr;
+	return &replay_players[number - 1];
+}
+
+// Remove a replay source from every scene that shows it
+static void remove_replay_source_items(const std::string &source_name)
+{
+	struct obs_frontend_source_list list = {};
+	obs_frontend_get_scenes(&list);
+	for (size_t i = 0; i < list.sources.num; i++) {
+		obs_scene_t *scene = obs_scene_from_source(list.sources.array[i]);
+		obs_sceneitem_t *item = scene ? obs_scene_find_source(scene, source_name.c_str()) : nullptr;
+		if (item)
+			obs_sceneitem_remove(item);
+	}
+	obs_frontend_source_list_free(&list);
+}
+
+// The caller holds source_mutex
+void ReplayPlayer::set_source_warm_locked(bool warm)
+{
+	if (!source || source_warm == warm)
+		return;
+	if (warm)
+		obs_source_inc_showing(source);
+	else
+		obs_source_dec_showing(source);
+	source_warm = warm;
+}
+
+void ReplayPlayer::set_source_warm(bool warm)
+{
+	std::lock_guard<std::mutex> lock(source_mutex);
+	set_source_warm_locked(warm);
+}
+
+// Take over a reference to the player's source as the persistent handle
+void ReplayPlayer::set_source(obs_source_t *new_source)
+{
+	std::lock_guard<std::mutex> lock(source_mutex);
+	set_source_warm_locked(false);
+	obs_source_release(source);
+	source = new_source;
+	set_source_warm_locked(preroll_enabled);
+}
+
+// New reference to the player's source, or nullptr if it has been removed
+obs_source_t *ReplayPlayer::get_source()
+{
+	std::lock_guard<std::mutex> lock(source_mutex);
+	if (!source || obs_source_removed(source))
+		return nullptr;
+	return obs_source_get_ref(source);
+}
+
+// Drop the handle. With `remove` the source itself is deleted as well.
+void ReplayPlayer::release_source(bool remove)
+{
+	obs_source_t *released;
+	{
+		std::lock_guard<std::mutex> lock(source_mutex);
+		set_source_warm_locked(false);
+		released = source;
+		source = nullptr;
+	}
+
+	if (released) {
+		blog(LOG_INFO, "Releasing replay source %s.", source_name.c_str());
+
+		remove_replay_source_items(source_name);
+		if (remove)
+			obs_source_remove(released); // Mark source for removal
+		obs_source_release(released);
+	}
+}
+
+static void set_preroll_enabled(bool enabled)
+{
+	preroll_enabled = enabled;
+	for (ReplayPlayer &player : replay_players)
+		player.set_source_warm(enabled);
+
+	obs_data_t *settings = obs_get_private_data();
+	obs_data_set_bool(settings, "preroll", enabled);
+	obs_data_release(settings);
+}
+
+// The source reads its player from its settings
+static obs_source_t *create_player_source(size_t index)
+{
+	obs_data_t *settings = obs_data_create();
+	obs_data_set_int(settings, "player", (long long)index);
+	obs_source_t *source =
+		obs_source_create(replay_source_info.id, get_player_source_name(index).c_str(), settings, nullptr);
+	obs_data_release(settings);
+	return source;
+}
+
+// Create the player's scene and source when needed
+bool ReplayPlayer::create_scene_and_source() {
+	// Held from an earlier call; nothing to look up
+	obs_source_t *held_source = get_source();
+	if (held_source) {
+		obs_source_release(held_source);
+		return true;
+	}
+
+	// Earlier versions fed raw frames into an ffmpeg_source; replace it
+	obs_source_t *existing_source = obs_get_source_by_name(source_name.c_str());
+	if (existing_source && strcmp(obs_source_get_id(existing_source), replay_source_info.id) != 0) {
+		blog(LOG_INFO, "Replacing legacy %s replay source", obs_source_get_id(existing_source));
+		obs_source_set_name(existing_source, (source_name + " (legacy)").c_str());
+		obs_source_remove(existing_source);
+		obs_source_release(existing_source);
+		existing_source = nullptr;
+	}
+
+	// Check if scene already exists
+	obs_source_t *existing_scene = obs_get_source_by_name(scene_name.c_str());
+	if (existing_scene) {
+		if (!existing_source) {
+			existing_source = create_player_source(index);
+			if (existing_source)
+				obs_scene_add(obs_scene_from_source(existing_scene), existing_source);
+		}
+		if (existing_source)
+			set_source(existing_source);
+		obs_source_release(existing_scene);
+		return existing_source != nullptr;
+	}
+	obs_source_release(existing_source);
+
+	// Create new scene
+	obs_scene_t *scene = obs_scene_create(scene_name.c_str());
+	if (!scene) {
+		blog(LOG_ERROR, "Failed to create replay scene");
+		return false;
+	}
+
+	// Create replay source
+	obs_source_t *new_source = create_player_source(index);
+	if (!new_source) {
+		obs_scene_release(scene);
+		blog(LOG_ERROR, "Failed to create replay source");
+		return false;
+	}
+
+	// Add source to scene
+	obs_sceneitem_t *scene_item = obs_scene_add(scene, new_source);
+	if (!scene_item) {
+		obs_source_release(new_source);
+		obs_scene_release(scene);
+		blog(LOG_ERROR, "Failed to add source to scene");
+		return false;
+	}
+
+	// The handle keeps the source reference
+	set_source(new_source);
+	obs_scene_release(scene);
+
+	blog(LOG_INFO, "Successfully created replay scene %s and source", scene_name.c_str());
+	return true;
+}
+
+// Colour parameters the async pipeline needs to convert YUV frames
+static void get_output_color_params(obs_source_frame *frame)
+{
+	video_t *video = obs_get_video();
+	const struct video_output_info *voi = video ? video_output_get_info(video) : nullptr;
+	if (!voi)
+		return;
+
+	video_format_get_parameters_for_format(voi->colorspace, voi->range, frame->format, frame->color_matrix,
+					       frame->color_range_min, frame->color_range_max);
+	frame->full_range = voi->range == VIDEO_RANGE_FULL;
+}
+
+// What the replay source shows. The player publishes it and waits the clip
+// out; the source pulls the frame due now on the render thread and the
+// audio due now on its tick, straight from the pinned ring.
+struct Playback {
+	VideoView video;        // Raw frames, or
+	TextureFrames textures; // GPU copies in texture mode
+	AudioView audio;        // Only played at normal speed
+	uint64_t first_timestamp = 0;
+	uint64_t last_timestamp = 0;
+	uint64_t start_time = 0; // os_gettime_ns() at which the first frame is shown
+	double speed = 1.0;
+
+	// Colour parameters for raw frames that carry none of their own
+	obs_source_frame color_params = {};
+
+	size_t size() const { return textures.empty() ? video.size() : textures.size(); }
+	uint64_t timestamp(size_t i) const { return textures.empty() ? video[i].frame.timestamp : textures[i]->timestamp; }
+
+	// Capture timestamp due at the given os_gettime_ns()
+	uint64_t due_timestamp(uint64_t now) const
+	{
+		uint64_t elapsed = now > start_time ? (uint64_t)((now - start_time) * speed) : 0;
+		return first_timestamp + elapsed;
+	}
+
+	// Latest frame whose captured offset has elapsed
+	size_t due_frame(uint64_t now) const
+	{
+		size_t next = seek_timestamp(size(), due_timestamp(now) + 1, [this](size_t i) { return timestamp(i); });
+		return next > 0 ? next - 1 : 0;
+	}
+
+	// os_gettime_ns() at which the last frame is due
+	uint64_t end_time() const { return start_time + (uint64_t)((last_timestamp - first_timestamp) / speed); }
+};
+
+static std::shared_ptr<Playback> make_texture_playback(const TextureFrames &frames, const AudioView &audio_frames,
+							double speed)
+{
+	auto playback = std::make_shared<Playback>();
+	playback->textures = frames;
+	playback->audio = audio_frames;
+	playback->speed = speed;
+	return playback;
+}
+
+// The snapshot pins its segments while the source reads them
+static std::shared_ptr<Playback> make_raw_playback(const FrameSnapshot &snapshot, double speed)
+{
+	auto playback = std::make_shared<Playback>();
+	playback->video = snapshot.video;
+	playback->audio = snapshot.audio;
+	playback->speed = speed;
+	playback->color_params.format = snapshot.video[0].frame.format;
+	get_output_color_params(&playback->color_params);
+	return playback;
+}
+
+// Hand a clip to the player's source, first frame due at `start_time`, and
+// wait until it has played out. The source keeps showing its last frame
+// until something replaces it. Returns false if it was cancelled.
+static bool show_playback(ReplayPlayer &player, const std::shared_ptr<Playback> &playback, uint64_t start_time)
+{
+	playback->first_timestamp = playback->timestamp(0);
+	playback->last_timestamp = playback->timestamp(playback->size() - 1);
+	playback->start_time = start_time;
+	std::atomic_store(&player.playback, std::shared_ptr<const Playback>(playback));
+
+	// The source draws the first frame on its next render
+	player.on_first_frame();
+
+	return player.wait_until_ns(playback->end_time());
+}
+
+// Play one clip and clear the source afterwards. Returns false if it was
+// cancelled.
+static bool run_playback(ReplayPlayer &player, const std::string &scene_name,
+			 const std::shared_ptr<Playback> &playback)
+{
+	bool completed = show_playback(player, playback, os_gettime_ns());
+	if (!completed)
+		blog(LOG_INFO, "Playback of scene %s cancelled", scene_name.c_str());
+
+	std::atomic_store(&player.playback, std::shared_ptr<const Playback>());
+	return completed;
+}
+
+// Play a texture replay. Returns false if nothing played or playback was
+// cancelled.
+bool play_texture_frames(ReplayPlayer &player, const std::string &scene_name, const TextureFrames &frames,
+			 const AudioView &audio_frames, double speed)
+{
+	if (frames.empty()) {
+		log_error("No texture frames cached for scene: " + scene_name);
+		return false;
+	}
+
+	blog(LOG_INFO, "Starting texture playback of %zu frames for scene: %s", frames.size(), scene_name.c_str());
+	return run_playback(player, scene_name, make_texture_playback(frames, audio_frames, speed));
+}
+
+// Play Cached Frames on Replay Source. Returns false if nothing played or
+// playback was cancelled.
+bool play_cached_frames(ReplayPlayer &player, const std::string &scene_name, const FrameSnapshot &snapshot,
+			double speed)
+{
+	if (snapshot.video.empty()) {
+		log_error("No video frames cached for scene: " + scene_name);
+		return false;
+	}
+
+	blog(LOG_INFO, "Starting playback of %zu video frames and %zu audio chunks for scene: %s",
+	     snapshot.video.size(), snapshot.audio.size(), scene_name.c_str());
+	return run_playback(player, scene_name, make_raw_playback(snapshot, speed));
+}
+
+// Scratch file for clips that only play, such as ranged encoded replays
+static std::string get_replay_file_path(const std::string &scene_name)
+{
+	return output_directory + "/" + scene_name + "_replay.mp4";
+}
+
+// One saved replay in the clip catalog. Offsets are milliseconds into the
+// file. The PTS of the first and last frame are on the capture clock for raw
+// clips and the encoder clock for encoded ones.
+struct ClipInfo {
+	uint64_t id = 0;
+	std::string scene;
+	std::string file; // Name within the catalog's directory
+	int64_t created = 0; // Unix time
+	uint64_t start_pts_usec = 0;
+	uint64_t end_pts_usec = 0;
+	int64_t duration_ms = 0;
+	uint64_t size = 0;
+	std::vector<int64_t> keyframes_ms;
+
+	// Latest keyframe at or before an offset, where playback can start
+	// without decoding a partial GOP
+	int64_t seek_offset(int64_t offset_ms) const
+	{
+		auto it = std::upper_bound(keyframes_ms.begin(), keyframes_ms.end(), offset_ms);
+		return it == keyframes_ms.begin() ? 0 : *(it - 1);
+	}
+};
+
+// Every replay saved to the output directory, with an index file next to
+// the clips. The index is read on first use and rewritten on each save, so
+// listing and playing clips never scans the directory.
+struct ClipCatalog {
+	static constexpr const char *index_name = "replay_clips.json";
+
+	std::mutex mutex;
+	std::string directory; // Where the loaded index lives; reloaded if the output moves
+	bool loaded = false;
+	uint64_t next_id = 1;
+	std::vector<ClipInfo> clips; // By id, oldest first
+	std::set<std::string> reserved; // File names of saves still being written
+
+	// Reserve a timestamped file name for a clip about to be saved. The id is
+	// only assigned by add(), so a failed save leaves no gap in the ids.
+	ClipInfo begin_clip(const std::string &scene_name)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		load_locked();
+
+		ClipInfo clip;
+		clip.scene = scene_name;
+		clip.created = (int64_t)time(nullptr);
+		char *stamp = os_generate_formatted_filename("mp4", false, "%CCYY-%MM-%DD_%hh-%mm-%ss");
+		std::string base = scene_name + "_" + (stamp ? stamp : "replay.mp4");
+		bfree(stamp);
+		base.resize(base.size() - 4);
+
+		// Saves of one scene within the same second get a counter
+		std::error_code error;
+		clip.file = base + ".mp4";
+		for (int n = 2; reserved.count(clip.file) ||
+				std::filesystem::exists(std::filesystem::u8path(directory + "/" + clip.file), error);
+		     n++)
+			clip.file = base + "_" + std::to_string(n) + ".mp4";
+		reserved.insert(clip.file);
+		return clip;
+	}
+
+	std::string get_path(const ClipInfo &clip)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return directory + "/" + clip.file;
+	}
+
+	// Commit a finished save and give it the next id
+	void add(ClipInfo &clip)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		load_locked();
+		reserved.erase(clip.file);
+		clip.id = next_id++;
+		clips.push_back(clip);
+		save_locked();
+	}
+
+	// Give back the name of a save that failed, and delete what it wrote
+	void abandon(const ClipInfo &clip)
+	{
+		std::string path;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			reserved.erase(clip.file);
+			path = directory + "/" + clip.file;
+		}
+		std::error_code error;
+		std::filesystem::remove(std::filesystem::u8path(path), error);
+	}
+
+	bool find(uint64_t id, ClipInfo &clip, std::string &path)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		load_locked();
+		auto it = lower_bound_locked(id);
+		if (it == clips.end() || it->id != id)
+			return false;
+		clip = *it;
+		path = directory + "/" + clip.file;
+		return true;
+	}
+
+	// Drop a clip whose file has gone missing
+	void remove(uint64_t id)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = lower_bound_locked(id);
+		if (it == clips.end() || it->id != id)
+			return;
+		clips.erase(it);
+		save_locked();
+	}
+
+	// Newest first, optionally of one scene
+	std::vector<ClipInfo> list(const std::string &scene_name, size_t limit)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		load_locked();
+		std::vector<ClipInfo> result;
+		for (auto it = clips.rbegin(); it != clips.rend() && result.size() < limit; ++it) {
+			if (scene_name.empty() || it->scene == scene_name)
+				result.push_back(*it);
+		}
+		return result;
+	}
+
+private:
+	std::vector<ClipInfo>::iterator lower_bound_locked(uint64_t id)
+	{
+		return std::lower_bound(clips.begin(), clips.end(), id,
+					[](const ClipInfo &entry, uint64_t value) { return entry.id < value; });
+	}
+
+	void load_locked()
+	{
+		if (loaded && directory == output_directory)
+			return;
+
+		loaded = true;
+		directory = output_directory;
+		clips.clear();
+		next_id = 1;
+
+		obs_data_t *index = obs_data_create_from_json_file_safe((directory + "/" + index_name).c_str(), "bak");
+		if (!index)
+			return;
+
+		next_id = std::max<uint64_t>(1, (uint64_t)obs_data_get_int(index, "next_id"));
+		obs_data_array_t *entries = obs_data_get_array(index, "clips");
+		for (size_t i = 0; i < obs_data_array_count(entries); i++) {
+			obs_data_t *entry = obs_data_array_item(entries, i);
+			ClipInfo clip;
+			clip.id = (uint64_t)obs_data_get_int(entry, "id");
+			clip.scene = obs_data_get_string(entry, "scene");
+			clip.file = obs_data_get_string(entry, "file");
+			clip.created = obs_data_get_int(entry, "created");
+			clip.start_pts_usec = (uint64_t)obs_data_get_int(entry, "start_pts_usec");
+			clip.end_pts_usec = (uint64_t)obs_data_get_int(entry, "end_pts_usec");
+			clip.duration_ms = obs_data_get_int(entry, "duration_ms");
+			clip.size = (uint64_t)obs_data_get_int(entry, "size");
+			// Comma-separated, to keep the index small
+			const char *keyframes = obs_data_get_string(entry, "keyframes_ms");
+			for (const char *cursor = keyframes; cursor && *cursor;) {
+				char *end = nullptr;
+				long long offset = strtoll(cursor, &end, 10);
+				if (end == cursor)
+					break;
+				clip.keyframes_ms.push_back(offset);
+				cursor = *end == ',' ? end + 1 : end;
+			}
+			obs_data_release(entry);
+
+			if (clip.id != 0 && !clip.file.empty()) {
+				next_id = std::max(next_id, clip.id + 1);
+				clips.push_back(std::move(clip));
+			}
+		}
+		obs_data_array_release(entries);
+		obs_data_release(index);
+
+		std::sort(clips.begin(), clips.end(), [](const ClipInfo &a, const ClipInfo &b) { return a.id < b.id; });
+		blog(LOG_INFO, "Loaded %zu saved clips from %s", clips.size(), directory.c_str());
+	}
+
+	void save_locked()
+	{
+		obs_data_t *index = obs_data_create();
+		obs_data_array_t *entries = obs_data_array_create();
+		for (const ClipInfo &clip : clips) {
+			std::string keyframes;
+			for (int64_t offset : clip.keyframes_ms) {
+				if (!keyframes.empty())
+					keyframes += ",";
+				keyframes += std::to_string(offset);
+			}
+
+			obs_data_t *entry = obs_data_create();
+			obs_data_set_int(entry, "id", (long long)clip.id);
+			obs_data_set_string(entry, "scene", clip.scene.c_str());
+			obs_data_set_string(entry, "file", clip.file.c_str());
+			obs_data_set_int(entry, "created", clip.created);
+			obs_data_set_int(entry, "start_pts_usec", (long long)clip.start_pts_usec);
+			obs_data_set_int(entry, "end_pts_usec", (long long)clip.end_pts_usec);
+			obs_data_set_int(entry, "duration_ms", clip.duration_ms);
+			obs_data_set_int(entry, "size", (long long)clip.size);
+			obs_data_set_string(entry, "keyframes_ms", keyframes.c_str());
+			obs_data_array_push_back(entries, entry);
+			obs_data_release(entry);
+		}
+		obs_data_set_int(index, "next_id", (long long)next_id);
+		obs_data_set_array(index, "clips", entries);
+		obs_data_array_release(entries);
+
+		std::string path = directory + "/" + index_name;
+		if (!obs_data_save_json_safe(index, path.c_str(), "tmp", "bak"))
+			log_error("Failed to write clip index: " + path);
+		obs_data_release(index);
+	}
+};
+
+static ClipCatalog clip_catalog;
+
+// Record a finished save and its size on disk
+static void add_saved_clip(ClipInfo &clip, const std::string &file_path)
+{
+	std::error_code error;
+	uintmax_t size = std::filesystem::file_size(std::filesystem::u8path(file_path), error);
+	clip.size = error ? 0 : (uint64_t)size;
+	clip_catalog.add(clip);
+}
+
+// Abandons a clip begun by a save unless the save reaches add_saved_clip.
+// Declared before the writer, so the file is closed before it is deleted.
+struct ClipReservation {
+	const ClipInfo &clip;
+	bool committed = false;
+
+	~ClipReservation()
+	{
+		if (!committed)
+			clip_catalog.abandon(clip);
+	}
+};
+
+// Formats the encoder can take straight from slot memory; anything else
+// goes through a scaler to I420 first
+static enum AVPixelFormat get_av_pixel_format(enum video_format format)
+{
+	switch (format) {
+	case VIDEO_FORMAT_I420:
+		return AV_PIX_FMT_YUV420P;
+	case VIDEO_FORMAT_NV12:
+		return AV_PIX_FMT_NV12;
+	case VIDEO_FORMAT_I444:
+		return AV_PIX_FMT_YUV444P;
+	default:
+		return AV_PIX_FMT_NONE;
+	}
+}
+
+// x264 threads per save. Saves encode on the CPU next to OBS's own encoder,
+// so each one is kept to a fixed share instead of one thread per core.
+static const int SAVE_ENCODER_THREADS = 2;
+
+// Offline encoder for a raw snapshot. Frames are handed to libavcodec as
+// fast as it takes them instead of being replayed through a live output.
+struct RawClipWriter {
+	AVFormatContext *ctx = nullptr;
+	AVCodecContext *video_ctx = nullptr;
+	AVCodecContext *audio_ctx = nullptr;
+	AVStream *video_stream = nullptr;
+	AVStream *audio_stream = nullptr;
+	AVPacket *packet = nullptr;
+	AVFrame *video_frame = nullptr;
+	AVFrame *audio_frame = nullptr;
+	video_scaler_t *scaler = nullptr;
+	bool header_written = false;
+	std::vector<int64_t> keyframes_ms; // For the clip catalog
+
+	// Audio is re-chunked into encoder-sized frames
+	int audio_filled = 0;
+	int64_t audio_pts = 0;
+
+	RawClipWriter() = default;
+	RawClipWriter(const RawClipWriter &) = delete;
+	RawClipWriter &operator=(const RawClipWriter &) = delete;
+
+	~RawClipWriter()
+	{
+		if (scaler)
+			video_scaler_destroy(scaler);
+		av_frame_free(&video_frame);
+		av_frame_free(&audio_frame);
+		av_packet_free(&packet);
+		avcodec_free_context(&video_ctx);
+		avcodec_free_context(&audio_ctx);
+		if (ctx) {
+			if (ctx->pb)
+				avio_closep(&ctx->pb);
+			avformat_free_context(ctx);
+		}
+	}
+
+	bool open_video(const obs_source_frame &first, const video_output_info *voi)
+	{
+		const AVCodec *codec = avcodec_find_encoder_by_name("libx264");
+		if (!codec)
+			codec = avcodec_find_encoder(AV_CODEC_ID_H264);
+		if (!codec || !(video_ctx = avcodec_alloc_context3(codec)))
+			return false;
+
+		enum AVPixelFormat pix_fmt = get_av_pixel_format(first.format);
+		video_ctx->width = (int)first.width;
+		video_ctx->height = (int)first.height;
+		video_ctx->pix_fmt = pix_fmt != AV_PIX_FMT_NONE ? pix_fmt : AV_PIX_FMT_YUV420P;
+		video_ctx->time_base = {1, 1000000};
+		video_ctx->framerate = {(int)voi->fps_num, (int)voi->fps_den};
+		video_ctx->gop_size = (int)(voi->fps_num / voi->fps_den) * 2;
+		video_ctx->color_range = voi->range == VIDEO_RANGE_FULL ? AVCOL_RANGE_JPEG : AVCOL_RANGE_MPEG;
+		if (voi->colorspace == VIDEO_CS_601) {
+			video_ctx->colorspace = AVCOL_SPC_SMPTE170M;
+			video_ctx->color_primaries = AVCOL_PRI_SMPTE170M;
+			video_ctx->color_trc = AVCOL_TRC_SMPTE170M;
+		} else {
+			video_ctx->colorspace = AVCOL_SPC_BT709;
+			video_ctx->color_primaries = AVCOL_PRI_BT709;
+			video_ctx->color_trc = voi->colorspace == VIDEO_CS_SRGB ? AVCOL_TRC_IEC61966_2_1
+									  : AVCOL_TRC_BT709;
+		}
+		if (ctx->oformat->flags & AVFMT_GLOBALHEADER)
+			video_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+		video_ctx->thread_count = SAVE_ENCODER_THREADS;
+
+		AVDictionary *options = nullptr;
+		av_dict_set(&options, "preset", "veryfast", 0);
+		av_dict_set(&options, "crf", "20", 0);
+		int ret = avcodec_open2(video_ctx, codec, &options);
+		av_dict_free(&options);
+		if (ret < 0)
+			return false;
+
+		video_frame = av_frame_alloc();
+		if (!video_frame)
+			return false;
+		video_frame->format = video_ctx->pix_fmt;
+		video_frame->width = video_ctx->width;
+		video_frame->height = video_ctx->height;
+		video_frame->color_range = video_ctx->color_range;
+		video_frame->colorspace = video_ctx->colorspace;
+
+		if (pix_fmt == AV_PIX_FMT_NONE) {
+			video_scale_info src = {first.format, first.width, first.height, voi->range, voi->colorspace};
+			video_scale_info dst = {VIDEO_FORMAT_I420, first.width, first.height, voi->range,
+						voi->colorspace};
+			if (video_scaler_create(&scaler, &dst, &src, VIDEO_SCALE_DEFAULT) != VIDEO_SCALER_SUCCESS)
+				return false;
+			if (av_frame_get_buffer(video_frame, 0) < 0)
+				return false;
+		}
+
+		video_stream = avformat_new_stream(ctx, nullptr);
+		if (!video_stream)
+			return false;
+		video_stream->time_base = video_ctx->time_base;
+		return avcodec_parameters_from_context(video_stream->codecpar, video_ctx) >= 0;
+	}
+
+	bool open_audio(const obs_source_audio &first)
+	{
+		const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_AAC);
+		if (!codec || !(audio_ctx = avcodec_alloc_context3(codec)))
+			return false;
+
+		audio_ctx->sample_fmt = AV_SAMPLE_FMT_FLTP;
+		audio_ctx->sample_rate = (int)first.samples_per_sec;
+		audio_ctx->bit_rate = ENCODED_AUDIO_BITRATE * 1000;
+		audio_ctx->time_base = {1, (int)first.samples_per_sec};
+		av_channel_layout_default(&audio_ctx->ch_layout, (int)get_audio_channels(first.speakers));
+		if (ctx->oformat->flags & AVFMT_GLOBALHEADER)
+			audio_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+		if (avcodec_open2(audio_ctx, codec, nullptr) < 0)
+			return false;
+
+		audio_frame = av_frame_alloc();
+		if (!audio_frame)
+			return false;
+		audio_frame->format = AV_SAMPLE_FMT_FLTP;
+		audio_frame->sample_rate = audio_ctx->sample_rate;
+		audio_frame->nb_samples = audio_ctx->frame_size > 0 ? audio_ctx->frame_size : 1024;
+		av_channel_layout_copy(&audio_frame->ch_layout, &audio_ctx->ch_layout);
+		if (av_frame_get_buffer(audio_frame, 0) < 0)
+			return false;
+
+		audio_stream = avformat_new_stream(ctx, nullptr);
+		if (!audio_stream)
+			return false;
+		audio_stream->time_base = audio_ctx->time_base;
+		return avcodec_parameters_from_context(audio_stream->codecpar, audio_ctx) >= 0;
+	}
+
+	// Pull everything the encoder has ready and hand it to the muxer
+	bool drain(AVCodecContext *codec, AVStream *stream)
+	{
+		for (;;) {
+			int ret = avcodec_receive_packet(codec, packet);
+			if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+				return true;
+			if (ret < 0)
+				return false;
+
+			av_packet_rescale_ts(packet, codec->time_base, stream->time_base);
+			packet->stream_index = stream->index;
+			if (stream == video_stream && (packet->flags & AV_PKT_FLAG_KEY))
+				keyframes_ms.push_back(av_rescale_q(packet->pts, stream->time_base, {1, 1000}));
+			ret = av_interleaved_write_frame(ctx, packet);
+			av_packet_unref(packet);
+			if (ret < 0)
+				return false;
+		}
+	}
+
+	bool encode(AVCodecContext *codec, AVStream *stream, const AVFrame *frame)
+	{
+		return avcodec_send_frame(codec, frame) >= 0 && drain(codec, stream);
+	}
+
+	bool write_video(const obs_source_frame &frame, int64_t pts)
+	{
+		if (scaler) {
+			if (av_frame_make_writable(video_frame) < 0)
+				return false;
+			uint32_t out_linesize[MAX_AV_PLANES] = {};
+			for (size_t i = 0; i < 3; i++)
+				out_linesize[i] = (uint32_t)video_frame->linesize[i];
+			if (!video_scaler_scale(scaler, video_frame->data, out_linesize, frame.data, frame.linesize))
+				return false;
+		} else {
+			// The encoder copies non-refcounted frames, so slot memory
+			// can be handed over directly
+			for (size_t i = 0; i < 3; i++) {
+				video_frame->data[i] = frame.data[i];
+				video_frame->linesize[i] = (int)frame.linesize[i];
+			}
+		}
+
+		video_frame->pts = pts;
+		return encode(video_ctx, video_stream, video_frame);
+	}
+
+	bool flush_audio_frame()
+	{
+		audio_frame->pts = audio_pts;
+		audio_pts += audio_filled;
+		audio_filled = 0;
+		return encode(audio_ctx, audio_stream, audio_frame);
+	}
+
+	bool write_audio(const obs_source_audio &audio)
+	{
+		const int channels = audio_ctx->ch_layout.nb_channels;
+		const int frame_size = audio_frame->nb_samples;
+		uint32_t read = 0;
+
+		while (read < audio.frames) {
+			if (audio_filled == 0 && av_frame_make_writable(audio_frame) < 0)
+				return false;
+
+			int count = std::min<int>(frame_size - audio_filled, (int)(audio.frames - read));
+			for (int c = 0; c < channels; c++) {
+				float *dst = reinterpret_cast<float *>(audio_frame->data[c]) + audio_filled;
+				if (audio.data[c])
+					std::memcpy(dst, reinterpret_cast<const float *>(audio.data[c]) + read,
+						    count * sizeof(float));
+				else
+					std::memset(dst, 0, count * sizeof(float));
+			}
+			audio_filled += count;
+			read += count;
+
+			if (audio_filled == frame_size && !flush_audio_frame())
+				return false;
+		}
+		return true;
+	}
+
+	bool finish()
+	{
+		bool success = true;
+		if (audio_ctx) {
+			// The AAC encoder accepts a short final frame
+			if (audio_filled > 0) {
+				audio_frame->nb_samples = audio_filled;
+				success = flush_audio_frame();
+			}
+			success = success && encode(audio_ctx, audio_stream, nullptr);
+		}
+		success = success && encode(video_ctx, video_stream, nullptr);
+		return success && av_write_trailer(ctx) >= 0;
+	}
+};
+
+static enum video_format get_texture_video_format(enum gs_color_format format)
+{
+	switch (format) {
+	case GS_RGBA:
+		return VIDEO_FORMAT_RGBA;
+	case GS_BGRA:
+		return VIDEO_FORMAT_BGRA;
+	case GS_BGRX:
+		return VIDEO_FORMAT_BGRX;
+	default:
+		return VIDEO_FORMAT_NONE;
+	}
+}
+
+// Read a pinned texture ring back into system memory for saving. The
+// graphics context is entered once per frame so rendering keeps running
+// while a long clip is copied.
+static VideoView read_back_textures(const TextureFrames &frames)
+{
+	SegmentRing<VideoSlot> ring;
+	if (frames.empty())
+		return ring.view();
+
+	const TextureSlot &first = *frames.front();
+	enum video_format format = get_texture_video_format(first.format);
+	if (format == VIDEO_FORMAT_NONE) {
+		log_error("Unsupported texture format for readback: " + std::to_string((int)first.format));
+		return ring.view();
+	}
+
+	obs_enter_graphics();
+	gs_stagesurf_t *stage = gs_stagesurface_create(first.width, first.height, first.format);
+	obs_leave_graphics();
+	if (!stage) {
+		log_error("Failed to create staging surface for texture readback");
+		return ring.view();
+	}
+
+	ring.reset(frames.size(), frames.size());
+	for (const auto &slot : frames) {
+		if (!slot->matches(first.width, first.height, first.format))
+			continue;
+
+		VideoSlot *entry = ring.next_entry();
+		bool copied = false;
+
+		obs_enter_graphics();
+		gs_stage_texture(stage, slot->texture);
+		uint8_t *data = nullptr;
+		uint32_t linesize = 0;
+		if (gs_stagesurface_map(stage, &data, &linesize)) {
+			size_t size = (size_t)linesize * first.height;
+			if (entry->reserve(size)) {
+				std::memcpy(entry->storage, data, size);
+				copied = true;
+			}
+			gs_stagesurface_unmap(stage);
+		}
+		obs_leave_graphics();
+
+		if (!copied) {
+			ring.cancel_entry();
+			log_error("Failed to read back replay texture");
+			break;
+		}
+
+		obs_source_frame &frame = entry->frame;
+		frame = {};
+		frame.width = first.width;
+		frame.height = first.height;
+		frame.format = format;
+		frame.timestamp = slot->timestamp;
+		frame.data[0] = entry->storage;
+		frame.linesize[0] = linesize;
+		entry->display_width = slot->display_width;
+		entry->display_height = slot->display_height;
+		ring.commit();
+	}
+
+	obs_enter_graphics();
+	gs_stagesurface_destroy(stage);
+	obs_leave_graphics();
+	return ring.view();
+}
+
+// Save frames to file
+static void count_export(uint64_t frames, uint64_t bytes, uint64_t elapsed_ns)
+{
+	replay_stats.saves.fetch_add(1, std::memory_order_relaxed);
+	replay_stats.saved_frames.fetch_add(frames, std::memory_order_relaxed);
+	replay_stats.saved_bytes.fetch_add(bytes, std::memory_order_relaxed);
+	replay_stats.save_ns.fetch_add(elapsed_ns, std::memory_order_relaxed);
+}
+
+// Encode a snapshot into a new clip in the catalog. `saved_clip` receives
+// its catalog entry.
+bool save_frames_to_file(const std::string &scene_name, const FrameSnapshot &snapshot,
+			 ClipInfo *saved_clip = nullptr)
+{
+	ScopedLatency latency(replay_stats.save);
+	const VideoView &video_frames = snapshot.video;
+	const AudioView &audio_frames = snapshot.audio;
+	if (video_frames.empty()) {
+		log_error("No video frames cached for scene: " + scene_name);
+		return false;
+	}
+
+	video_t *video = obs_get_video();
+	const struct video_output_info *voi = video ? video_output_get_info(video) : nullptr;
+	if (!voi) {
+		log_error("Video output not available for scene: " + scene_name);
+		return false;
+	}
+
+	const obs_source_frame &first = video_frames[0].frame;
+	const uint64_t first_timestamp = first.timestamp;
+
+	// Audio from before the first frame has nothing to sync against
+	size_t next_audio = 0;
+	while (next_audio < audio_frames.size() && audio_frames.timestamp(next_audio) < first_timestamp)
+		next_audio++;
+
+	ClipInfo clip = clip_catalog.begin_clip(scene_name);
+	std::string file_path = clip_catalog.get_path(clip);
+	ClipReservation reservation{clip};
+	RawClipWriter writer;
+	if (avformat_alloc_output_context2(&writer.ctx, nullptr, "mp4", file_path.c_str()) < 0 || !writer.ctx) {
+		log_error("Failed to create muxer for scene: " + scene_name);
+		return false;
+	}
+
+	if (!writer.open_video(first, voi)) {
+		log_error("Failed to open video encoder for scene: " + scene_name);
+		return false;
+	}
+
+	if (next_audio < audio_frames.size()) {
+		const obs_source_audio first_audio = audio_frames[next_audio];
+		if (!writer.open_audio(first_audio)) {
+			log_error("Failed to open audio encoder for scene: " + scene_name);
+			return false;
+		}
+		uint64_t audio_offset_usec = (first_audio.timestamp - first_timestamp) / 1000;
+		writer.audio_pts =
+			av_rescale_q((int64_t)audio_offset_usec, {1, 1000000}, writer.audio_ctx->time_base);
+	}
+
+	writer.packet = av_packet_alloc();
+	if (!writer.packet || avio_open(&writer.ctx->pb, file_path.c_str(), AVIO_FLAG_WRITE) < 0) {
+		log_error("Failed to open replay file: " + file_path);
+		return false;
+	}
+	if (avformat_write_header(writer.ctx, nullptr) < 0) {
+		log_error("Failed to write replay header for scene: " + scene_name);
+		return false;
+	}
+
+	bool success = true;
+	int64_t last_pts = -1;
+	for (size_t i = 0; success && i < video_frames.size(); i++) {
+		const obs_source_frame &frame = video_frames[i].frame;
+		if (frame.width != first.width || frame.height != first.height || frame.format != first.format)
+			continue;
+
+		// Audio captured up to this frame goes in first so the muxer
+		// interleaves without buffering much
+		while (success && writer.audio_ctx && next_audio < audio_frames.size() &&
+		       audio_frames.timestamp(next_audio) <= frame.timestamp) {
+			success = writer.write_audio(audio_frames[next_audio]);
+			next_audio++;
+		}
+
+		int64_t pts = (int64_t)((frame.timestamp - first_timestamp) / 1000);
+		if (pts <= last_pts)
+			continue;
+		last_pts = pts;
+		success = success && writer.write_video(frame, pts);
+	}
+
+	success = success && writer.finish();
+	if (!success) {
+		log_error("Failed to encode replay for scene: " + scene_name);
+		return false;
+	}
+
+	uint64_t bytes = 0;
+	for (size_t i = 0; i < video_frames.size(); i++)
+		bytes += video_frames[i].size;
+	count_export(video_frames.size(), bytes, latency.elapsed());
+
+	clip.start_pts_usec = first_timestamp / 1000;
+	clip.end_pts_usec = video_frames[video_frames.size() - 1].frame.timestamp / 1000;
+	clip.duration_ms = (int64_t)(clip.end_pts_usec - clip.start_pts_usec) / 1000;
+	clip.keyframes_ms = std::move(writer.keyframes_ms);
+	add_saved_clip(clip, file_path);
+	reservation.committed = true;
+	if (saved_clip)
+		*saved_clip = clip;
+
+	blog(LOG_INFO, "Saved replay for scene: %s to file: %s", scene_name.c_str(), file_path.c_str());
+	return true;
+}
+
+static enum AVCodecID get_av_codec_id(const std::string &codec)
+{
+	if (codec == "h264")
+		return AV_CODEC_ID_H264;
+	if (codec == "hevc")
+		return AV_CODEC_ID_HEVC;
+	if (codec == "av1")
+		return AV_CODEC_ID_AV1;
+	if (codec == "aac")
+		return AV_CODEC_ID_AAC;
+	if (codec == "opus")
+		return AV_CODEC_ID_OPUS;
+	return AV_CODEC_ID_NONE;
+}
+
+static void set_stream_extra_data(AVCodecParameters *par, const std::vector<uint8_t> &extra_data)
+{
+	if (extra_data.empty())
+		return;
+
+	par->extradata = static_cast<uint8_t *>(av_mallocz(extra_data.size() + AV_INPUT_BUFFER_PADDING_SIZE));
+	if (par->extradata) {
+		std::memcpy(par->extradata, extra_data.data(), extra_data.size());
+		par->extradata_size = (int)extra_data.size();
+	}
+}
+
+// Write already-encoded packets into an mp4 without re-encoding
+static bool remux_packets_to_file(const std::string &file_path, const PacketStreamInfo &info,
+				  const std::vector<std::shared_ptr<encoder_packet>> &packets,
+				  std::vector<int64_t> *keyframes_ms = nullptr)
+{
+	if (packets.empty())
+		return false;
+
+	AVFormatContext *ctx = nullptr;
+	if (avformat_alloc_output_context2(&ctx, nullptr, "mp4", file_path.c_str()) < 0 || !ctx)
+		return false;
+
+	AVStream *video_stream = avformat_new_stream(ctx, nullptr);
+	AVStream *audio_stream = avformat_new_stream(ctx, nullptr);
+	if (!video_stream || !audio_stream) {
+		avformat_free_context(ctx);
+		return false;
+	}
+
+	AVRational video_timebase = {1, 1000000};
+	for (const auto &packet : packets) {
+		if (packet->type == OBS_ENCODER_VIDEO) {
+			video_timebase = {packet->timebase_num, packet->timebase_den};
+			break;
+		}
+	}
+
+	video_stream->time_base = video_timebase;
+	video_stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+	video_stream->codecpar->codec_id = get_av_codec_id(info.video_codec);
+	video_stream->codecpar->width = (int)info.width;
+	video_stream->codecpar->height = (int)info.height;
+	set_stream_extra_data(video_stream->codecpar, info.video_extra_data);
+
+	audio_stream->time_base = {1, (int)info.sample_rate};
+	audio_stream->codecpar->codec_type = AVMEDIA_TYPE_AUDIO;
+	audio_stream->codecpar->codec_id = get_av_codec_id(info.audio_codec);
+	audio_stream->codecpar->sample_rate = (int)info.sample_rate;
+	audio_stream->codecpar->frame_size = 1024;
+	av_channel_layout_default(&audio_stream->codecpar->ch_layout, (int)info.channels);
+	set_stream_extra_data(audio_stream->codecpar, info.audio_extra_data);
+
+	if (avio_open(&ctx->pb, file_path.c_str(), AVIO_FLAG_WRITE) < 0) {
+		avformat_free_context(ctx);
+		return false;
+	}
+
+	bool success = avformat_write_header(ctx, nullptr) >= 0;
+
+	// The ring starts on a video keyframe; make that time zero for both tracks
+	const int64_t start_usec = packets.front()->dts_usec;
+	AVPacket *av_packet = av_packet_alloc();
+
+	for (size_t i = 0; success && i < packets.size(); i++) {
+		const encoder_packet *packet = packets[i].get();
+		bool is_video = packet->type == OBS_ENCODER_VIDEO;
+		AVStream *stream = is_video ? video_stream : audio_stream;
+		AVRational packet_timebase = {packet->timebase_num, packet->timebase_den};
+		int64_t offset = av_rescale_q(start_usec, {1, 1000000}, packet_timebase);
+
+		if (packet->dts - offset < 0)
+			continue;
+
+		av_packet->data = packet->data;
+		av_packet->size = (int)packet->size;
+		av_packet->stream_index = stream->index;
+		av_packet->pts = av_rescale_q(packet->pts - offset, packet_timebase, stream->time_base);
+		av_packet->dts = av_rescale_q(packet->dts - offset, packet_timebase, stream->time_base);
+		av_packet->flags = packet->keyframe ? AV_PKT_FLAG_KEY : 0;
+		if (keyframes_ms && is_video && packet->keyframe)
+			keyframes_ms->push_back(av_rescale_q(av_packet->pts, stream->time_base, {1, 1000}));
+
+		success = av_interleaved_write_frame(ctx, av_packet) >= 0;
+		av_packet_unref(av_packet);
+	}
+
+	if (success)
+		success = av_write_trailer(ctx) >= 0;
+
+	av_packet_free(&av_packet);
+	avio_closep(&ctx->pb);
+	avformat_free_context(ctx);
+	return success;
+}
+
+// Save a scene's packet ring as a new clip in the catalog (encoded mode)
+bool save_packets_to_file(const std::string &scene_name, const std::vector<std::shared_ptr<encoder_packet>> &packets,
+			  const std::shared_ptr<const PacketStreamInfo> &info, ClipInfo *saved_clip = nullptr)
+{
+	ScopedLatency latency(replay_stats.save);
+	if (!info) {
+		log_error("Encoder stream info not available for scene: " + scene_name);
+		return false;
+	}
+
+	ClipInfo clip = clip_catalog.begin_clip(scene_name);
+	std::string file_path = clip_catalog.get_path(clip);
+	ClipReservation reservation{clip};
+	if (!remux_packets_to_file(file_path, *info, packets, &clip.keyframes_ms)) {
+		log_error("Failed to remux replay for scene: " + scene_name);
+		return false;
+	}
+
+	uint64_t bytes = 0;
+	size_t video_packets = 0;
+	for (const auto &packet : packets) {
+		bytes += packet->size;
+		video_packets += packet->type == OBS_ENCODER_VIDEO;
+	}
+	count_export(video_packets, bytes, latency.elapsed());
+
+	clip.start_pts_usec = (uint64_t)std::max<int64_t>(packets.front()->dts_usec, 0);
+	clip.end_pts_usec = (uint64_t)std::max<int64_t>(packets.back()->dts_usec, 0);
+	clip.duration_ms = (int64_t)(clip.end_pts_usec - clip.start_pts_usec) / 1000;
+	add_saved_clip(clip, file_path);
+	reservation.committed = true;
+	if (saved_clip)
+		*saved_clip = clip;
+
+	blog(LOG_INFO, "Remuxed %zu packets for scene: %s to file: %s", packets.size(), scene_name.c_str(),
+	     file_path.c_str());
+	return true;
+}
+
+// ffmpeg_source opens a new file asynchronously and drops a seek issued
+// before then, so a clip with an in point waits for media_started
+struct ClipStart {
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool started = false;
+
+	static void on_started(void *data, calldata_t *cd)
+	{
+		UNUSED_PARAMETER(cd);
+		ClipStart *start = static_cast<ClipStart *>(data);
+		{
+			std::lock_guard<std::mutex> lock(start->mutex);
+			start->started = true;
+		}
+		start->wake.notify_all();
+	}
+
+	bool wait(std::chrono::milliseconds timeout)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		return wake.wait_for(lock, timeout, [this] { return started; });
+	}
+};
+
+// Play a saved clip through the replay source. Encoded mode has no raw
+// frames in the ring, so the source's private media child decodes the
+// remuxed file and the source draws that instead.
+void play_clip_file(ReplayPlayer &player, const std::string &file_path, int64_t duration_usec, double speed = 1.0,
+		    bool loop = false, int64_t start_ms = 0)
+{
+	obs_source_t *replay = player.get_source();
+	obs_source_t *source = replay ? replay_source_get_clip(replay) : nullptr;
+	obs_source_release(replay);
+	if (!source) {
+		log_error("Replay source not found");
+		return;
+	}
+
+	obs_data_t *settings = obs_data_create();
+	obs_data_set_bool(settings, "is_local_file", true);
+	obs_data_set_string(settings, "local_file", file_path.c_str());
+	obs_data_set_bool(settings, "restart_on_activate", true);
+	obs_data_set_int(settings, "speed_percent", (long long)(speed * 100.0 + 0.5));
+	obs_data_set_bool(settings, "looping", loop);
+
+	ClipStart start;
+	signal_handler_t *signals = obs_source_get_signal_handler(source);
+	if (start_ms > 0)
+		signal_handler_connect(signals, "media_started", ClipStart::on_started, &start);
+	obs_source_update(source, settings);
+	obs_data_release(settings);
+	if (start_ms > 0) {
+		bool started = start.wait(std::chrono::seconds(3));
+		signal_handler_disconnect(signals, "media_started", ClipStart::on_started, &start);
+		if (started) {
+			obs_source_media_set_time(source, start_ms);
+		} else {
+			blog(LOG_WARNING, "Clip %s did not start in time; playing from the beginning",
+			     file_path.c_str());
+			start_ms = 0;
+		}
+	}
+	player.clip_playing = true;
+	player.on_first_frame();
+
+	// The media source loops on its own, from the start of the file; this
+	// side only waits the passes out
+	uint64_t pass_ns = (uint64_t)(duration_usec * 1000 / speed);
+	uint64_t skipped_ns = (uint64_t)(std::min<int64_t>(start_ms * 1000, duration_usec) * 1000 / speed);
+	uint64_t deadline = os_gettime_ns() + pass_ns - skipped_ns;
+	while (player.wait_until_ns(deadline) && loop && player.keep_looping())
+		deadline += pass_ns;
+
+	player.clip_playing = false;
+	obs_source_media_stop(source);
+	if (loop) {
+		settings = obs_data_create();
+		obs_data_set_bool(settings, "looping", false);
+		obs_source_update(source, settings);
+		obs_data_release(settings);
+	}
+	obs_source_release(source);
+}
+
+// Packets of a request's range, widened back to the keyframe that opens it
+static std::vector<std::shared_ptr<encoder_packet>>
+slice_packets(const std::vector<std::shared_ptr<encoder_packet>> &packets, const ReplayRequest &request)
+{
+	if (!request.ranged || packets.empty())
+		return packets;
+
+	auto dts_ns = [&](size_t i) { return (uint64_t)std::max<int64_t>(packets[i]->dts_usec, 0) * 1000; };
+	uint64_t newest = dts_ns(packets.size() - 1);
+	size_t begin = seek_timestamp(packets.size(), request.start_timestamp(newest), dts_ns);
+	size_t end = seek_timestamp(packets.size(), request.end_timestamp(newest) + 1, dts_ns);
+	while (begin > 0 && !(packets[begin]->type == OBS_ENCODER_VIDEO && packets[begin]->keyframe))
+		begin--;
+	if (begin >= end)
+		return {};
+	return std::vector<std::shared_ptr<encoder_packet>>(packets.begin() + begin, packets.begin() + end);
+}
+
+// Remux a scene's packets and play the result. A ranged clip goes to a
+// scratch file so it does not replace the saved replay.
+static void play_encoded_replay(ReplayPlayer &player, const ReplayRequest &request)
+{
+	const std::string &scene_name = request.scene_name;
+	std::vector<std::shared_ptr<encoder_packet>> packets;
+	std::shared_ptr<const PacketStreamInfo> info = std::atomic_load(&packet_stream_info);
+	std::shared_ptr<FrameBuffer> buffer = find_buffer(scene_name);
+	if (buffer)
+		packets = slice_packets(buffer->get_packets(), request);
+
+	if (packets.empty()) {
+		log_error("No encoded packets cached for scene: " + scene_name);
+		return;
+	}
+
+	int64_t duration_usec = packets.back()->dts_usec - packets.front()->dts_usec;
+	if (!request.ranged) {
+		ClipInfo clip;
+		if (save_packets_to_file(scene_name, packets, info, &clip))
+			play_clip_file(player, clip_catalog.get_path(clip), duration_usec);
+		return;
+	}
+
+	// One scratch file per player, as two may play ranges of the same scene
+	std::string range_name = scene_name + "_range";
+	if (player.index > 0)
+		range_name += "_" + std::to_string(player.index + 1);
+	std::string file_path = get_replay_file_path(range_name);
+	if (!info || !remux_packets_to_file(file_path, *info, packets)) {
+		log_error("Failed to remux replay range for scene: " + scene_name);
+		return;
+	}
+	play_clip_file(player, file_path, duration_usec, request.speed, request.loop);
+}
+
+// The frames captured from `start` to `end`, inclusive. Audio is left whole;
+// playback seeks into it from the first frame.
+static FrameSnapshot slice_snapshot(const FrameSnapshot &snapshot, uint64_t start, uint64_t end)
+{
+	const VideoView &video = snapshot.video;
+	auto timestamp_at = [&](size_t i) { return video[i].frame.timestamp; };
+	size_t begin = seek_timestamp(video.size(), start, timestamp_at);
+	size_t stop = seek_timestamp(video.size(), end == UINT64_MAX ? end : end + 1, timestamp_at);
+
+	FrameSnapshot result;
+	result.video = video.slice(begin, stop);
+	result.audio = snapshot.audio;
+	return result;
+}
+
+static FrameSnapshot slice_snapshot(const FrameSnapshot &snapshot, const ReplayRequest &request)
+{
+	if (!request.ranged || snapshot.video.empty())
+		return snapshot;
+
+	uint64_t newest = snapshot.video[snapshot.video.size() - 1].frame.timestamp;
+	return slice_snapshot(snapshot, request.start_timestamp(newest), request.end_timestamp(newest));
+}
+
+static TextureFrames slice_texture_frames(const TextureFrames &frames, uint64_t start, uint64_t end)
+{
+	auto timestamp_at = [&](size_t i) { return frames[i]->timestamp; };
+	size_t begin = seek_timestamp(frames.size(), start, timestamp_at);
+	size_t stop = seek_timestamp(frames.size(), end == UINT64_MAX ? end : end + 1, timestamp_at);
+	return begin < stop ? TextureFrames(frames.begin() + begin, frames.begin() + stop) : TextureFrames();
+}
+
+static TextureFrames slice_texture_frames(const TextureFrames &frames, const ReplayRequest &request)
+{
+	if (!request.ranged || frames.empty())
+		return frames;
+
+	uint64_t newest = frames[frames.size() - 1]->timestamp;
+	return slice_texture_frames(frames, request.start_timestamp(newest), request.end_timestamp(newest));
+}
+
+static void save_frames_in_background(const std::string &scene_name, const FrameSnapshot &snapshot);
+
+// Raw frames: a full replay is also saved; a ranged one only plays. With
+// preroll the save runs on the save pool while the replay plays.
+static void play_raw_replay(ReplayPlayer &player, const ReplayRequest &request, const FrameSnapshot &snapshot)
+{
+	if (!request.ranged && preroll_enabled)
+		save_frames_in_background(request.scene_name, snapshot);
+	else if (!request.ranged)
+		save_frames_to_file(request.scene_name, snapshot);
+
+	FrameSnapshot clip = slice_snapshot(snapshot, request);
+	while (play_cached_frames(player, request.scene_name, clip, request.speed) && request.loop &&
+	       player.keep_looping())
+		;
+}
+
+// Play a clip from the catalog, starting at the keyframe before the offset
+static void play_catalog_clip(ReplayPlayer &player, const ReplayRequest &request)
+{
+	ClipInfo clip;
+	std::string file_path;
+	if (!clip_catalog.find(request.clip_id, clip, file_path)) {
+		log_error("No saved clip with id " + std::to_string(request.clip_id));
+		return;
+	}
+
+	std::error_code error;
+	if (!std::filesystem::exists(std::filesystem::u8path(file_path), error)) {
+		log_error("Saved clip is missing: " + file_path);
+		clip_catalog.remove(clip.id);
+		return;
+	}
+
+	int64_t start_ms = clip.seek_offset(request.clip_offset_ms);
+	blog(LOG_INFO, "Playing saved clip %llu of scene %s from %lld ms", (unsigned long long)clip.id,
+	     clip.scene.c_str(), (long long)start_ms);
+	play_clip_file(player, file_path, clip.duration_ms * 1000, request.speed, request.loop, start_ms);
+}
+
+// Play a ReplaySequence. Its segments were pinned when it was queued and
+// encoded ones are remuxed here before the first plays. Raw and texture
+// segments are chained: each is due the moment the last one ends and
+// replaces it in the source directly, so nothing blank is shown between.
+static void play_sequence(ReplayPlayer &player, const ReplayRequest &request)
+{
+	const std::vector<SequenceSegment> &sequence = request.sequence;
+	std::shared_ptr<const PacketStreamInfo> info = std::atomic_load(&packet_stream_info);
+	std::vector<std::string> clip_paths(sequence.size());
+	for (size_t i = 0; i < sequence.size(); i++) {
+		if (sequence[i].packets.empty())
+			continue;
+
+		// Scratch files per player and segment, as one scene may appear twice
+		std::string name = "sequence_" + std::to_string(player.index + 1) + "_" + std::to_string(i);
+		std::string file_path = get_replay_file_path(name);
+		if (info && remux_packets_to_file(file_path, *info, sequence[i].packets))
+			clip_paths[i] = file_path;
+		else
+			log_error("Failed to remux sequence segment for scene: " + sequence[i].scene_name);
+	}
+
+	blog(LOG_INFO, "Starting sequence of %zu segments", sequence.size());
+	bool completed = true;
+	std::shared_ptr<Playback> previous; // Loops chain on as well
+	do {
+		for (size_t i = 0; i < sequence.size() && completed; i++) {
+			const SequenceSegment &segment = sequence[i];
+			if (!segment.packets.empty()) {
+				if (clip_paths[i].empty())
+					continue;
+				std::atomic_store(&player.playback, std::shared_ptr<const Playback>());
+				previous.reset();
+				const auto &packets = segment.packets;
+				int64_t duration_usec = packets.back()->dts_usec - packets.front()->dts_usec;
+				play_clip_file(player, clip_paths[i], duration_usec, segment.speed);
+				completed = !player.cancel_current;
+				continue;
+			}
+
+			std::shared_ptr<Playback> playback =
+				segment.textures.empty() ? make_raw_playback(segment.raw, segment.speed)
+							 : make_texture_playback(segment.textures, segment.raw.audio,
+										 segment.speed);
+			uint64_t start_time = previous ? previous->end_time() : os_gettime_ns();
+			completed = show_playback(player, playback, start_time);
+			previous = playback;
+		}
+	} while (completed && request.loop && player.keep_looping());
+
+	if (!completed)
+		blog(LOG_INFO, "Sequence playback cancelled");
+	std::atomic_store(&player.playback, std::shared_ptr<const Playback>());
+}
+
+// Save and play one scene's replay on the player's source
+void play_replay(ReplayPlayer &player, const ReplayRequest &request)
+{
+	const std::string &scene_name = request.scene_name;
+	if (!request.sequence.empty()) {
+		play_sequence(player, request);
+		return;
+	}
+	if (request.clip_id != 0) {
+		play_catalog_clip(player, request);
+		return;
+	}
+
+	// Sources with a replay_capture filter always hold raw frames
+	std::shared_ptr<FrameBuffer> source_buffer = find_source_buffer(scene_name);
+	if (source_buffer) {
+		play_raw_replay(player, request, source_buffer->snapshot());
+		return;
+	}
+
+	BufferMode mode = buffer_mode;
+	if (mode == BufferMode::Encoded) {
+		play_encoded_replay(player, request);
+		return;
+	}
+
+	std::shared_ptr<FrameBuffer> buffer = find_buffer(scene_name);
+	if (!buffer) {
+		log_error("No buffer found for scene: " + scene_name);
+		return;
+	}
+
+	// Textures are drawn straight from the ring; only an explicit save
+	// reads them back
+	if (mode == BufferMode::Texture) {
+		TextureFrames frames = slice_texture_frames(buffer->texture_snapshot(), request);
+		AudioView audio = buffer->snapshot().audio;
+		while (play_texture_frames(player, scene_name, frames, audio, request.speed) && request.loop &&
+		       player.keep_looping())
+			;
+		return;
+	}
+
+	// One snapshot serves both the save and the playback
+	play_raw_replay(player, request, buffer->snapshot());
+}
+
+// Worker loop. Queued replays play back to back; the program only returns
+// to the previous scene once the queue has drained, and only if no other
+// player has cut to its own scene since.
+void ReplayPlayer::run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (running) {
+		wake.wait(lock, [this] { return !running || !queue.empty(); });
+		if (!running)
+			break;
+
+		ReplayRequest request = queue.front();
+		queue.pop_front();
+		cancel_current = false;
+		lock.unlock();
+
+		if (!in_replay && request.switch_scene) {
+			// Save current scene. On another player's scene, return to
+			// where that player would have.
+			obs_source_t *current_scene = obs_frontend_get_current_scene();
+			if (current_scene) {
+				std::string current_name = obs_source_get_name(current_scene);
+				ReplayPlayer *other = find_player_by_scene(current_name);
+				std::lock_guard<std::mutex> scene_lock(return_scene_mutex);
+				return_scenes[index] = other ? return_scenes[other->index] : current_name;
+				obs_source_release(current_scene);
+			}
+
+			// Switch to replay scene, right away or once playback has a frame
+			switch_pending = true;
+			if (!preroll_enabled)
+				on_first_frame();
+		}
+
+		play_replay(*this, request);
+		switch_pending = false; // Nothing played; stay on the program scene
+
+		lock.lock();
+		if (queue.empty() && in_replay) {
+			lock.unlock();
+			// Switch back to previous scene
+			obs_source_t *current_scene = obs_frontend_get_current_scene();
+			bool on_own_scene = current_scene && scene_name == obs_source_get_name(current_scene);
+			obs_source_release(current_scene);
+			std::string return_scene;
+			{
+				std::lock_guard<std::mutex> scene_lock(return_scene_mutex);
+				return_scene = return_scenes[index];
+			}
+			if (on_own_scene && !return_scene.empty())
+				switch_to_scene(return_scene);
+			in_replay = false;
+			lock.lock();
+		}
+	}
+}
+
+// WebSocket callback definitions
+static void on_replay_request(obs_data_t *request_data, obs_data_t *response_data, void *priv_data)
+{
+	(void)priv_data; // Mark as intentionally unused
+	const char *scene_name = obs_data_get_string(request_data, "scene");
+	if (!scene_name) {
+		obs_data_set_bool(response_data, "success", false);
+		obs_data_set_string(response_data, "error", "No scene name provided");
+		return;
+	}
+
+	ReplayPlayer *player = get_request_player(request_data);
+	if (!player) {
+		obs_data_set_bool(response_data, "success", false);
+		obs_data_set_string(response_data, "error", "No such replay player");
+		return;
+	}
+
+	// Ensure Replay Source and Scene are created
+	player->create_scene_and_source();
+
+	ReplayRequest request;
+	request.scene_name = scene_name;
+	if (obs_data_has_user_value(request_data, "switch_scene"))
+		request.switch_scene = obs_data_get_bool(request_data, "switch_scene");
+	bool preempt = obs_data_get_bool(request_data, "preempt");
+	if (!player->enqueue(request, preempt)) {
+		obs_data_set_bool(response_data, "success", false);
+		obs_data_set_string(response_data, "error", "Replay queue is full");
+		return;
+	}
+	obs_data_set_bool(response_data, "success", true);
+}
+
+// Read a range's "last" seconds, or "from" to "to" seconds before now, and
+// its "speed" into `request`. Returns an error message, or nullptr.
+static const char *read_replay_range(obs_data_t *data, ReplayRequest &request)
+{
+	double from = obs_data_has_user_value(data, "last") ? obs_data_get_double(data, "last")
+							    : obs_data_get_double(data, "from");
+	double to = obs_data_has_user_value(data, "last") ? 0.0 : obs_data_get_double(data, "to");
+	bool whole = !obs_data_has_user_value(data, "last") && !obs_data_has_user_value(data, "from");
+	double speed = obs_data_has_user_value(data, "speed") ? obs_data_get_double(data, "speed") : 1.0;
+	if (to < 0.0 || (!whole && from <= to))
+		return "Range must end after it starts";
+	if (!(speed >= 0.1 && speed <= 2.0))
+		return "Speed must be between 0.1 and 2";
+
+	request.ranged = true;
+	request.from_ns = whole ? UINT64_MAX : (uint64_t)(from * 1e9);
+	request.to_ns = (uint64_t)(to * 1e9);
+	request.speed = speed;
+	return nullptr;
+}
+
+// Play part of a buffer without saving it first: "last" seconds, or "from"
+// to "to" seconds before now, at "speed", optionally looping
+static void on_play_replay_range(obs_data_t *request_data, obs_data_t *response_data, void *priv_data)
+{
+	(void)priv_data; // Mark as intentionally unused
+	const char *scene_name = obs_data_get_string(request_data, "scene");
+	if (!scene_name || !*scene_name) {
+		obs_data_set_bool(response_data, "success", false);
+		obs_data_set_string(response_data, "error", "No scene name provided");
+		return;
+	}
+
+	ReplayRequest request;
+	ReplayPlayer *player = get_request_player(request_data);
+	const char *error = nullptr;
+	if (!player)
+		error = "No such replay player";
+	else
+		error = read_replay_range(request_data, request);
+	if (error) {
+		obs_data_set_bool(response_data, "success", false);
+		obs_data_set_string(response_data, "error", error);
+		return;
+	}
+
+	player->create_scene_and_source();
+
+	request.scene_name = scene_name;
+	request.loop = obs_data_get_bool(request_data, "loop");
+	if (obs_data_has_user_value(request_data, "switch_scene"))
+		request.switch_scene = obs_data_get_bool(request_data, "switch_scene");
+	if (!player->enqueue(request, obs_data_get_bool(request_data, "preempt"))) {
+		obs_data_set_bool(response_data, "success", false);
+		obs_data_set_string(response_data, "error", "Replay queue is full");
+		return;
+	}
+	obs_data_set_bool(response_data, "success", true);
+}
+
+// Longest ReplaySequence accepted; every segment pins its frames until it
+// has played
+static const size_t MAX_SEQUENCE_SEGMENTS = 16;
+
+// Slice and pin one sequence entry from the buffer it would play from.
+// Returns false if nothing in its range is buffered.
+static bool pin_sequence_segment(const ReplayRequest &range, SequenceSegment &segment)
+{
+	segment.scene_name = range.scene_name;
+	segment.speed = range.speed;
+
+	// Sources with a replay_capture filter always hold raw frames
+	std::shared_ptr<FrameBuffer> source_buffer = find_source_buffer(range.scene_name);
+	std::shared_ptr<FrameBuffer> buffer = source_buffer ? source_buffer : find_buffer(range.scene_name);
+	if (!buffer)
+		return false;
+
+	BufferMode mode = source_buffer ? BufferMode::Raw : buffer_mode.load();
+	if (mode == BufferMode::Encoded) {
+		segment.packets = slice_packets(buffer->get_packets(), range);
+		return !segment.packets.empty();
+	}
+	if (mode == BufferMode::Texture) {
+		segment.textures = slice_texture_frames(buffer->texture_snapshot(), range);
+		segment.raw.audio = buffer->snapshot().audio;
+		return !segment.textures.empty();
+	}
+	segment.raw = slice_snapshot(buffer->snapshot(), range);
+	return !segment.raw.video.empty();
+}
+
+// Play ranges of several scenes back to back as one replay. "segments" is an
+// ordered array of {scene, last | from/to, speed}. Every range is pinned now,
+// so it covers the history as of this request however long the queue ahead
+// of it takes. Takes the player, loop, switch_scene and preempt options of
+// PlayReplayRange.
+static void on_replay_sequence(obs_data_t *request_data, obs_data_t *response_data, void *priv_data)
+{
+	(void)priv_data; // Mark as intentionally unused
+	ReplayPlayer *player = get_request_player(request_data);
+	if (!player) {
+		obs_data_set_bool(response_data, "success", false);
+		obs_data_set_string(response_data, "error", "No such replay player");
+		return;
+	}
+
+	obs_data_array_t *segments = obs_data_get_array(request_data, "segments");
+	size_t count = segments ? obs_data_array_count(segments) : 0;
+	std::string error;
+	if (count == 0)
+		error = "No segments provided";
+	else if (count > MAX_SEQUENCE_SEGMENTS)
+		error = "Too many segments; at most " + std::to_string(MAX_SEQUENCE_SEGMENTS);
+
+	ReplayRequest request;
+	uint64_t duration_ns = 0;
+	for (size_t i = 0; i < count && error.empty(); i++) {
+		obs_data_t *item = obs_data_array_item(segments, i);
+		const char *scene_name = obs_data_get_string(item, "scene");
+		ReplayRequest range;
+		const char *range_error = read_replay_range(item, range);
+		range.scene_name = scene_name ? scene_name : "";
+
+		SequenceSegment segment;
+		std::string label = "Segment " + std::to_string(i + 1);
+		if (range.scene_name.empty())
+			error = label + ": no scene name provided";
+		else if (range_error)
+			error = label + ": " + range_error;
+		else if (!pin_sequence_segment(range, segment))
+			error = label + ": nothing buffered for scene " + range.scene_name;
+		if (error.empty()) {
+			duration_ns += segment.duration_ns();
+			request.sequence.push_back(std::move(segment));
+		}
+		obs_data_release(item);
+	}
+	obs_data_array_release(segments);
+	if (!error.empty()) {
+		obs_data_set_bool(response_data, "success", false);
+		obs_data_set_string(response_data, "error", error.c_str());
+		return;
+	}
+
+	player->create_scene_and_source();
+
+	request.scene_name = request.sequence.front().scene_name;
+	request.loop = obs_data_get_bool(request_data, "loop");
+	if (obs_data_has_user_value(request_data, "switch_scene"))
+		request.switch_scene = obs_data_get_bool(request_data, "switch_scene");
+	if (!player->enqueue(request, obs_data_get_bool(request_data, "preempt"))) {
+		obs_data_set_bool(response_data, "success", false);
+		obs_data_set_string(response_data, "error", "Replay queue is full");
+		return;
+	}
+	obs_data_set_int(response_data, "segments", (long long)count);
+	obs_data_set_double(response_data, "duration", (double)duration_ns / 1e9);
+	obs_data_set_bool(response_data, "success", true);
+}
+
+// Saved clips from the catalog, newest first. Optional "scene" and "limit".
+static void on_list_replay_clips(obs_data_t *request_data, obs_data_t *response_data, void *priv_data)
+{
+	(void)priv_data; // Mark as intentionally unused
+	const char *scene_name = obs_data_get_string(request_data, "scene");
+	long long limit = obs_data_get_int(request_data, "limit");
+	std::vector<ClipInfo> clips =
+		clip_catalog.list(scene_name ? scene_name : "", limit > 0 ? (size_t)limit : SIZE_MAX);
+
+	obs_data_array_t *array = obs_data_array_create();
+	for (const ClipInfo &clip : clips) {
+		obs_data_t *item = obs_data_create();
+		obs_data_set_int(item, "id", (long long)clip.id);
+		obs_data_set_string(item, "scene", clip.scene.c_str());
+		obs_data_set_string(item, "file", clip.file.c_str());
+		obs_data_set_int(item, "created", clip.created);
+		obs_data_set_int(item, "start_pts_usec", (long long)clip.start_pts_usec);
+		obs_data_set_int(item, "end_pts_usec", (long long)clip.end_pts_usec);
+		obs_data_set_double(item, "duration", (double)clip.duration_ms / 1000.0);
+		obs_data_set_int(item, "size", (long long)clip.size);
+		obs_data_set_int(item, "keyframes", (long long)clip.keyframes_ms.size());
+		obs_data_array_push_back(array, item);
+		obs_data_release(item);
+	}
+	obs_data_set_array(response_data, "clips", array);
+	obs_data_array_release(array);
+	obs_data_set_bool(response_data, "success", true);
+}
+
+// Play a saved clip by "id", optionally from "offset" seconds in. Takes the
+// player, speed, loop, switch_scene and preempt options of PlayReplayRange.
+static void on_play_replay_clip(obs_data_t *request_data, obs_data_t *response_data, void *priv_data)
+{
+	(void)priv_data; // Mark as intentionally unused
+	uint64_t id = (uint64_t)obs_data_get_int(request_data, "id");
+	double offset = obs_data_get_double(request_data, "offset");
+	double speed = obs_data_has_user_value(request_data, "speed") ? obs_data_get_double(request_data, "speed") : 1.0;
+
+	ClipInfo clip;
+	std::string file_path;
+	ReplayPlayer *player = get_request_player(request_data);
+	const char *error = nullptr;
+	if (!clip_catalog.find(id, clip, file_path))
+		error = "No saved clip with that id";
+	else if (!player)
+		error = "No such replay player";
+	else if (offset < 0.0 || offset * 1000.0 >= (double)std::max<int64_t>(clip.duration_ms, 1))
+		error = "Offset is outside the clip";
+	else if (!(speed >= 0.1 && speed <= 2.0))
+		error = "Speed must be between 0.1 and 2";
+	if (error) {
+		obs_data_set_bool(response_data, "success", false);
+		obs_data_set_string(response_data, "error", error);
+		return;
+	}
+
+	player->create_scene_and_source();
+
+	ReplayRequest request;
+	request.scene_name = clip.scene;
+	request.clip_id = id;
+	request.clip_offset_ms = (int64_t)(offset * 1000.0);
+	request.speed = speed;
+	request.loop = obs_data_get_bool(request_data, "loop");
+	if (obs_data_has_user_value(request_data, "switch_scene"))
+		request.switch_scene = obs_data_get_bool(request_data, "switch_scene");
+	if (!player->enqueue(request, obs_data_get_bool(request_data, "preempt"))) {
+		obs_data_set_bool(response_data, "success", false);
+		obs_data_set_string(response_data, "error", "Replay queue is full");
+		return;
+	}
+	obs_data_set_bool(response_data, "success", true);
+}
+
+// Cancel one player's replays, or every player's if "player" is omitted
+static void on_cancel_replay(obs_data_t *request_data, obs_data_t *response_data, void *priv_data)
+{
+	(void)priv_data; // Mark as intentionally unused
+
+	if (!obs_data_has_user_value(request_data, "player")) {
+		for (ReplayPlayer &player : replay_players)
+			player.cancel();
+		obs_data_set_bool(response_data, "success", true);
+		return;
+	}
+
+	ReplayPlayer *player = get_request_player(request_data);
+	if (!player) {
+		obs_data_set_bool(response_data, "success", false);
+		obs_data_set_string(response_data, "error", "No such replay player");
+		return;
+	}
+	player->cancel();
+	obs_data_set_bool(response_data, "success", true);
+}
+
+static obs_data_t *get_latency_data(const LatencyHistogram &histogram)
+{
+	obs_data_t *data = obs_data_create();
+	uint64_t count = histogram.count.load(std::memory_order_relaxed);
+	obs_data_set_int(data, "count", (long long)count);
+	obs_data_set_double(data, "mean_us",
+			    count ? (double)histogram.total_ns.load(std::memory_order_relaxed) / count / 1000.0 : 0.0);
+	obs_data_set_double(data, "p50_us", (double)histogram.percentile(0.50) / 1000.0);
+	obs_data_set_double(data, "p99_us", (double)histogram.percentile(0.99) / 1000.0);
+	obs_data_set_double(data, "max_us", (double)histogram.max_ns.load(std::memory_order_relaxed) / 1000.0);
+	return data;
+}
+
+static void add_buffer_usage(obs_data_array_t *array, const std::string &name, const char *type,
+			     const FrameBuffer &buffer)
+{
+	FrameBuffer::Usage usage = buffer.get_usage();
+	CaptureProfile profile = buffer.get_profile();
+	obs_data_t *item = obs_data_create();
+	obs_data_set_string(item, "name", name.c_str());
+	obs_data_set_string(item, "type", type);
+	obs_data_set_string(item, "scale", get_capture_scale_name(profile.scale_divisor));
+	obs_data_set_int(item, "frame_interval", profile.frame_interval);
+	obs_data_set_int(item, "video_frames", (long long)usage.video_frames);
+	obs_data_set_double(item, "video_seconds", usage.video_seconds);
+	obs_data_set_int(item, "video_bytes", (long long)usage.video_bytes);
+	obs_data_set_int(item, "spilled_bytes", (long long)usage.spilled_bytes);
+	obs_data_set_int(item, "audio_bytes", (long long)usage.audio_bytes);
+	obs_data_set_int(item, "texture_frames", (long long)usage.texture_frames);
+	obs_data_set_int(item, "texture_bytes", (long long)usage.texture_bytes);
+	obs_data_set_int(item, "packets", (long long)usage.packets);
+	obs_data_set_int(item, "packet_bytes", (long long)usage.packet_bytes);
+	if (usage.shared_bytes > 0)
+		obs_data_set_string(item, "shared_ring", get_shared_ring_name(name).c_str());
+	obs_data_set_int(item, "shared_bytes", (long long)usage.shared_bytes);
+	obs_data_set_int(item, "resident_bytes",
+			 (long long)(usage.video_bytes + usage.audio_bytes + usage.texture_bytes + usage.packet_bytes));
+	obs_data_array_push_back(array, item);
+	obs_data_release(item);
+}
+
+// Telemetry since the plugin loaded: callback latencies, lock waits, frame
+// counts, per-buffer memory and export throughput
+static void on_get_replay_stats(obs_data_t *request_data, obs_data_t *response_data, void *priv_data)
+{
+	(void)priv_data;    // Mark as intentionally unused
+	(void)request_data; // Mark as intentionally unused
+
+	obs_data_t *latency = obs_data_create();
+	const std::pair<const char *, const LatencyHistogram *> histograms[] = {
+		{"raw_video", &replay_stats.raw_video},
+		{"texture_video", &replay_stats.texture_video},
+		{"filter_video", &replay_stats.filter_video},
+		{"audio", &replay_stats.audio},
+		{"playback_render", &replay_stats.playback_render},
+		{"save", &replay_stats.save},
+		{"buffer_map_lock_wait", &replay_stats.map_lock_wait},
+		{"buffer_lock_wait", &replay_stats.buffer_lock_wait},
+	};
+	for (const auto &histogram : histograms) {
+		obs_data_t *data = get_latency_data(*histogram.second);
+		obs_data_set_obj(latency, histogram.first, data);
+		obs_data_release(data);
+	}
+	obs_data_set_obj(response_data, "latency", latency);
+	obs_data_release(latency);
+
+	auto events = [](CaptureEvent event) {
+		return (long long)capture_events[(size_t)event].load(std::memory_order_relaxed);
+	};
+	obs_data_t *frames = obs_data_create();
+	obs_data_set_int(frames, "captured", events(CaptureEvent::VideoFrame) + events(CaptureEvent::TextureFrame));
+	obs_data_set_int(frames, "dropped",
+			 events(CaptureEvent::VideoSkipped) + events(CaptureEvent::VideoRejected) +
+				 events(CaptureEvent::SlotFailure));
+	obs_data_set_int(frames, "skipped", events(CaptureEvent::VideoSkipped));
+	obs_data_set_int(frames, "rejected", events(CaptureEvent::VideoRejected));
+	obs_data_set_int(frames, "slot_failures", events(CaptureEvent::SlotFailure));
+	obs_data_set_int(frames, "evicted", events(CaptureEvent::VideoEvicted));
+	obs_data_set_int(frames, "thinned", events(CaptureEvent::VideoThinned));
+	obs_data_set_int(frames, "audio_chunks", events(CaptureEvent::AudioChunk));
+	obs_data_set_int(frames, "packets", events(CaptureEvent::Packet));
+	obs_data_set_obj(response_data, "frames", frames);
+	obs_data_release(frames);
+
+	obs_data_array_t *buffers = obs_data_array_create();
+	for (const auto &buffer : get_all_buffers())
+		add_buffer_usage(buffers, buffer.first, "scene", *buffer.second);
+	for (const auto &buffer : get_all_source_buffers())
+		add_buffer_usage(buffers, buffer.first, "source", *buffer.second);
+	obs_data_set_array(response_data, "buffers", buffers);
+	obs_data_array_release(buffers);
+	obs_data_set_int(response_data, "buffered_video_bytes", (long long)buffered_video_bytes.load());
+
+	double save_seconds = (double)replay_stats.save_ns.load(std::memory_order_relaxed) / 1e9;
+	uint64_t saved_bytes = replay_stats.saved_bytes.load(std::memory_order_relaxed);
+	uint64_t saved_frames = replay_stats.saved_frames.load(std::memory_order_relaxed);
+	obs_data_t *exports = obs_data_create();
+	obs_data_set_int(exports, "saves", (long long)replay_stats.saves.load(std::memory_order_relaxed));
+	obs_data_set_int(exports, "frames", (long long)saved_frames);
+	obs_data_set_int(exports, "bytes", (long long)saved_bytes);
+	obs_data_set_double(exports, "seconds", save_seconds);
+	obs_data_set_double(exports, "frames_per_second", save_seconds > 0.0 ? saved_frames / save_seconds : 0.0);
+	obs_data_set_double(exports, "bytes_per_second", save_seconds > 0.0 ? saved_bytes / save_seconds : 0.0);
+	obs_data_set_obj(response_data, "export", exports);
+	obs_data_release(exports);
+
+	obs_data_set_bool(response_data, "success", true);
+}
+
+// Give one scene or filtered source its own history length. A non-positive
+// "seconds" returns it to the default.
+static void on_set_replay_duration(obs_data_t *request_data, obs_data_t *response_data, void *priv_data)
+{
+	(void)priv_data; // Mark as intentionally unused
+	const char *name = obs_data_get_string(request_data, "scene");
+	if (!name || !*name) {
+		obs_data_set_bool(response_data, "success", false);
+		obs_data_set_string(response_data, "error", "No scene name provided");
+		return;
+	}
+
+	long long seconds = obs_data_get_int(request_data, "seconds");
+	if (seconds > MAX_BUFFER_SECONDS) {
+		obs_data_set_bool(response_data, "success", false);
+		obs_data_set_string(response_data, "error", "Duration is too long");
+		return;
+	}
+
+	{
+		BufferMapLock lock;
+		if (seconds > 0)
+			buffer_durations[name] = (int)seconds;
+		else
+			buffer_durations.erase(name);
+	}
+	save_buffer_settings();
+
+	blog(LOG_INFO, "Replay history for %s set to %s", name,
+	     seconds > 0 ? (std::to_string(seconds) + " seconds").c_str() : "the default");
+	obs_data_set_bool(response_data, "success", true);
+}
+
+// Thin out the video of one scene or filtered source with "scale" (full,
+// half or quarter) and "frame_interval" (keep every Nth frame). Full size at
+// every frame returns it to the default. Its raw and texture history restarts.
+static void on_set_capture_profile(obs_data_t *request_data, obs_data_t *response_data, void *priv_data)
+{
+	(void)priv_data; // Mark as intentionally unused
+	const char *name = obs_data_get_string(request_data, "scene");
+	if (!name || !*name) {
+		obs_data_set_bool(response_data, "success", false);
+		obs_data_set_string(response_data, "error", "No scene name provided");
+		return;
+	}
+
+	CaptureProfile profile;
+	const char *scale = obs_data_get_string(request_data, "scale");
+	if (scale && *scale && !parse_capture_scale(scale, profile.scale_divisor)) {
+		obs_data_set_bool(response_data, "success", false);
+		obs_data_set_string(response_data, "error", "Scale must be full, half or quarter");
+		return;
+	}
+
+	if (obs_data_has_user_value(request_data, "frame_interval")) {
+		long long interval = obs_data_get_int(request_data, "frame_interval");
+		if (interval < 1 || interval > (long long)MAX_FRAME_INTERVAL) {
+			obs_data_set_bool(response_data, "success", false);
+			obs_data_set_string(response_data, "error", "Frame interval is out of range");
+			return;
+		}
+		profile.frame_interval = (uint32_t)interval;
+	}
+
+	{
+		BufferMapLock lock;
+		if (profile.is_full())
+			capture_profiles.erase(name);
+		else
+			capture_profiles[name] = profile;
+	}
+	save_buffer_settings();
+
+	blog(LOG_INFO, "Capture profile for %s set to %s size, every %u frame(s)", name,
+	     get_capture_scale_name(profile.scale_divisor), profile.frame_interval);
+	obs_data_set_bool(response_data, "success", true);
+}
+
+// Mirror the raw frames of one scene or filtered source into a named
+// shared-memory ring ("enabled"), keeping the newest "frames" (60 by
+// default). The response carries the ring's "name".
+static void on_set_shared_export(obs_data_t *request_data, obs_data_t *response_data, void *priv_data)
+{
+	(void)priv_data; // Mark as intentionally unused
+	const char *name = obs_data_get_string(request_data, "scene");
+	if (!name || !*name) {
+		obs_data_set_bool(response_data, "success", false);
+		obs_data_set_string(response_data, "error", "No scene name provided");
+		return;
+	}
+
+	bool enabled = obs_data_get_bool(request_data, "enabled");
+	long long frames = obs_data_has_user_value(request_data, "frames") ? obs_data_get_int(request_data, "frames")
+									   : DEFAULT_SHARED_FRAMES;
+	if (enabled && (frames < 1 || frames > (long long)MAX_SHARED_FRAMES)) {
+		obs_data_set_bool(response_data, "success", false);
+		obs_data_set_string(response_data, "error", "Frame count is out of range");
+		return;
+	}
+
+	{
+		BufferMapLock lock;
+		if (enabled)
+			shared_exports[name] = (uint32_t)frames;
+		else
+			shared_exports.erase(name);
+		for (auto *map : {&scene_buffers, &source_buffers}) {
+			auto it = map->find(name);
+			if (it != map->end())
+				apply_shared_export(name, *it->second);
+		}
+	}
+	save_buffer_settings();
+
+	std::string ring_name = get_shared_ring_name(name);
+	if (enabled)
+		blog(LOG_INFO, "Shared export of %s to %s, %lld frames", name, ring_name.c_str(), frames);
+	else
+		blog(LOG_INFO, "Shared export of %s stopped", name);
+	obs_data_set_bool(response_data, "success", true);
+	obs_data_set_string(response_data, "name", ring_name.c_str());
+}
 
-	if (!source) {
-		obs_scene_release(scene);
-		blog(LOG_ERROR, "Failed to create replay source");
-		return false;
+// Define a scene group from {"group", "scenes": [{"name"}, ...]}. An empty
+// scene list deletes the group.
+static void on_set_scene_group(obs_data_t *request_data, obs_data_t *response_data, void *priv_data)
+{
+	(void)priv_data; // Mark as intentionally unused
+	const char *group_name = obs_data_get_string(request_data, "group");
+	if (!group_name || !*group_name) {
+		obs_data_set_bool(response_data, "success", false);
+		obs_data_set_string(response_data, "error", "No group name provided");
+		return;
 	}
 
-	// Add source to scene
-	obs_sceneitem_t *scene_item = obs_scene_add(scene, source);
-	if (!scene_item) {
-		obs_source_release(source);
-		obs_scene_release(scene);
-		blog(LOG_ERROR, "Failed to add source to scene");
-		return false;
+	obs_data_array_t *scenes = obs_data_get_array(request_data, "scenes");
+	std::vector<std::string> names = get_scene_names(scenes);
+	obs_data_array_release(scenes);
+
+	bool active;
+	{
+		BufferMapLock lock;
+		if (names.empty()) {
+			scene_groups.erase(group_name);
+			if (current_group == group_name)
+				current_group.clear();
+		} else {
+			scene_groups[group_name] = names;
+		}
+		active = current_group == group_name;
 	}
+	save_scene_groups();
 
-	// Release references
-	obs_source_release(source);
-	obs_scene_release(scene);
+	// Membership of the active group changed under the live buffers
+	if (active || names.empty())
+		update_scene_buffers();
 
-	blog(LOG_INFO, "Successfully created replay scene and source");
-	return true;
+	blog(LOG_INFO, "Scene group %s %s (%zu scenes)", group_name, names.empty() ? "removed" : "set", names.size());
+	obs_data_set_bool(response_data, "success", true);
 }
 
-// Switch Scenes
-void switch_to_scene(const std::string &scene_name)
+// Select the group to buffer; "" buffers every scene
+static void on_set_active_group(obs_data_t *request_data, obs_data_t *response_data, void *priv_data)
 {
-	obs_source_t *scene = obs_get_source_by_name(scene_name.c_str());
-	if (scene) {
-		obs_frontend_set_current_scene(scene);
-		obs_source_release(scene);
-	} else {
-		log_error("Scene not found: " + scene_name);
+	(void)priv_data; // Mark as intentionally unused
+	const char *group_name = obs_data_get_string(request_data, "group");
+	if (!set_active_group(group_name ? group_name : "")) {
+		obs_data_set_bool(response_data, "success", false);
+		obs_data_set_string(response_data, "error", "Group not found");
+		return;
 	}
+	obs_data_set_bool(response_data, "success", true);
 }
 
-// Play Cached Frames on Replay Source
-void play_cached_frames(const std::string &scene_name)
+// Raw saves are CPU x264 encodes. Half the logical cores stay with OBS's
+// render, encode and audio threads; the pool gets one worker per
+// SAVE_ENCODER_THREADS of the rest, and at least one.
+static size_t get_save_worker_count()
 {
-    blog(LOG_INFO, "Attempting to play cached frames for scene: %s", scene_name.c_str());
+	int spare_cores = std::max(1, os_get_logical_cores()) / 2;
+	return (size_t)std::max(1, spare_cores / SAVE_ENCODER_THREADS);
+}
 
-    std::lock_guard<std::mutex> lock(buffer_mutex);
-    auto it = scene_buffers.find(scene_name);
-    if (it == scene_buffers.end()) {
-        log_error("No buffer found for scene: " + scene_name);
-        return;
-    }
+// Let the render thread and OBS's encoder win when a save competes with
+// them. Threads x264 starts from here inherit it on Linux and macOS.
+static void lower_thread_priority()
+{
+#if defined(_WIN32)
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+#elif defined(__APPLE__)
+	pthread_set_qos_class_self_np(QOS_CLASS_UTILITY, 0);
+#elif defined(__linux__)
+	setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 10); // Per thread on Linux
+#endif
+}
 
-    auto video_frames = it->second.get_video_frames();
-    auto audio_frames = it->second.get_audio_frames();
+// Bounded pool of save workers, started on first use
+struct SaveWorkerPool {
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<std::function<void()>> tasks;
+	bool running = false;
+
+	void submit(std::function<void()> task) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!running) {
+				size_t count = get_save_worker_count();
+				running = true;
+				for (size_t i = 0; i < count; i++) {
+					workers.emplace_back(&SaveWorkerPool::run, this);
+				}
+				blog(LOG_INFO, "Started %zu save workers", count);
+			}
+			tasks.push_back(std::move(task));
+		}
+		wake.notify_one();
+	}
 
-    blog(LOG_INFO, "Retrieved %zu video frames and %zu audio frames", 
-        video_frames.size(), audio_frames.size());
+	// Finishes the tasks already queued, then joins the workers
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!running)
+				return;
+			running = false;
+		}
+		wake.notify_all();
+		for (auto &worker : workers) {
+			if (worker.joinable())
+				worker.join();
+		}
+		workers.clear();
+	}
 
-    if (video_frames.empty()) {
-        log_error("No video frames cached for scene: " + scene_name);
-        return;
-    }
+	void run() {
+		lower_thread_priority();
 
-    // Get the replay source with additional logging
-    obs_source_t *replay_source = obs_get_source_by_name(REPLAY_SOURCE_NAME);
-    if (!replay_source) {
-        log_error("Replay source not found");
-        return;
-    }
+		std::unique_lock<std::mutex> lock(mutex);
+		for (;;) {
+			wake.wait(lock, [this] { return !running || !tasks.empty(); });
+			if (tasks.empty())
+				return;
 
-    blog(LOG_INFO, "Starting playback of %zu frames", video_frames.size());
+			std::function<void()> task = std::move(tasks.front());
+			tasks.pop_front();
+			lock.unlock();
+			task();
+			lock.lock();
+		}
+	}
+};
 
-    // Play frames with detailed logging
-    for (size_t i = 0; i < video_frames.size(); ++i) {
-        if (i < audio_frames.size() && audio_frames[i]) {
-            blog(LOG_DEBUG, "Outputting audio frame %zu", i);
-            obs_source_output_audio(replay_source, audio_frames[i].get());
-        }
-        
-        if (video_frames[i]) {
-            blog(LOG_DEBUG, "Outputting video frame %zu - Width: %d, Height: %d", 
-                i, video_frames[i]->width, video_frames[i]->height);
-            obs_source_output_video(replay_source, video_frames[i].get());
-        }
-        
-        std::this_thread::sleep_for(std::chrono::milliseconds(33)); // ~30fps
-    }
+static SaveWorkerPool save_pool;
 
-    blog(LOG_INFO, "Finished playing %zu frames for scene: %s", 
-        video_frames.size(), scene_name.c_str());
-    obs_source_release(replay_source);
-}
+// Checks idle buffers every few seconds of frame time
+static const float IDLE_CHECK_INTERVAL = 5.0f;
+static float idle_check_elapsed = 0.0f;
+static std::atomic<bool> idle_check_pending{false};
 
-// Save frames to file
-void save_frames_to_file(const std::string &scene_name,
-			 const std::vector<std::shared_ptr<obs_source_frame>> &video_frames,
-			 const std::vector<std::shared_ptr<obs_source_audio>> &audio_frames)
+static void idle_tick_callback(void *, float seconds)
 {
-	std::string file_path = output_directory + "/" + scene_name + "_replay.mp4";
+	idle_check_elapsed += seconds;
+	if (idle_check_elapsed < IDLE_CHECK_INTERVAL)
+		return;
+	idle_check_elapsed = 0.0f;
 
-	obs_output_t *output = obs_output_create("ffmpeg_muxer", "replay_output", nullptr, nullptr);
-	if (!output) {
-		log_error("Failed to create output for scene: " + scene_name);
+	if (!plugin_enabled || idle_buffer_seconds <= 0 || idle_check_pending.exchange(true))
 		return;
+	save_pool.submit([]() {
+		age_idle_buffers();
+		idle_check_pending = false;
+	});
+}
+
+// The snapshot pins its segments, so the save can outlive the playback
+static void save_frames_in_background(const std::string &scene_name, const FrameSnapshot &snapshot)
+{
+	save_pool.submit([scene_name, snapshot]() { save_frames_to_file(scene_name, snapshot); });
+}
+
+// One SaveAllReplays request, tracked until its last scene finishes
+struct SaveJob {
+	uint64_t id = 0;
+	size_t total = 0;
+	std::atomic<size_t> completed{0};
+	std::atomic<size_t> failed{0};
+};
+
+static std::atomic<uint64_t> next_save_job_id{0};
+
+static void emit_vendor_event(const char *event_name, obs_data_t *event_data)
+{
+	if (websocket_vendor)
+		obs_websocket_vendor_emit_event(websocket_vendor, event_name, event_data);
+}
+
+static void report_save_completed(const SaveJob &job)
+{
+	obs_data_t *event_data = obs_data_create();
+	obs_data_set_int(event_data, "job_id", (long long)job.id);
+	obs_data_set_int(event_data, "total", (long long)job.total);
+	obs_data_set_int(event_data, "failed", (long long)job.failed.load());
+	emit_vendor_event("SaveReplaysCompleted", event_data);
+	obs_data_release(event_data);
+
+	blog(LOG_INFO, "Save job %llu finished: %zu scenes, %zu failed", (unsigned long long)job.id, job.total,
+	     job.failed.load());
+}
+
+// Report one finished scene, and the whole job once the last one is in
+static void report_save_progress(const std::shared_ptr<SaveJob> &job, const std::string &scene_name, bool success)
+{
+	if (!success)
+		job->failed++;
+	size_t completed = ++job->completed;
+
+	obs_data_t *event_data = obs_data_create();
+	obs_data_set_int(event_data, "job_id", (long long)job->id);
+	obs_data_set_string(event_data, "scene", scene_name.c_str());
+	obs_data_set_bool(event_data, "success", success);
+	obs_data_set_int(event_data, "completed", (long long)completed);
+	obs_data_set_int(event_data, "total", (long long)job->total);
+	emit_vendor_event("SaveReplaysProgress", event_data);
+	obs_data_release(event_data);
+
+	if (completed == job->total)
+		report_save_completed(*job);
+}
+
+// Pins every scene's history now and saves it in the background. The
+// response carries a job ID; progress arrives as vendor events.
+static void on_save_all_replays(obs_data_t *request_data, obs_data_t *response_data, void *priv_data)
+{
+	(void)priv_data;    // Mark as intentionally unused
+	(void)request_data; // Mark as intentionally unused
+
+	auto job = std::make_shared<SaveJob>();
+	job->id = ++next_save_job_id;
+	std::vector<std::pair<std::string, std::function<bool()>>> saves;
+
+	BufferMode mode = buffer_mode;
+	if (mode == BufferMode::Encoded) {
+		std::shared_ptr<const PacketStreamInfo> info = std::atomic_load(&packet_stream_info);
+		for (auto &buffer_pair : get_all_buffers()) {
+			if (!buffer_pair.second->has_packets())
+				continue;
+			std::string scene_name = buffer_pair.first;
+			auto packets = buffer_pair.second->get_packets();
+			saves.emplace_back(scene_name, [scene_name, packets, info]() {
+				return save_packets_to_file(scene_name, packets, info);
+			});
+		}
+	} else if (mode == BufferMode::Texture) {
+		// Readback happens on the pool, not in the request handler
+		for (auto &buffer_pair : get_all_buffers()) {
+			TextureFrames frames = buffer_pair.second->texture_snapshot();
+			if (frames.empty())
+				continue;
+			std::string scene_name = buffer_pair.first;
+			AudioView audio = buffer_pair.second->snapshot().audio;
+			saves.emplace_back(scene_name, [scene_name, frames, audio]() {
+				FrameSnapshot snapshot;
+				snapshot.video = read_back_textures(frames);
+				snapshot.audio = audio;
+				return save_frames_to_file(scene_name, snapshot);
+			});
+		}
+	} else {
+		// Each buffer is only locked while its snapshot is taken
+		for (auto &buffer_pair : get_all_buffers()) {
+			FrameSnapshot snapshot = buffer_pair.second->snapshot();
+			if (snapshot.video.empty())
+				continue;
+			std::string scene_name = buffer_pair.first;
+			saves.emplace_back(scene_name, [scene_name, snapshot]() {
+				return save_frames_to_file(scene_name, snapshot);
+			});
+		}
 	}
 
-	// Configure output settings
-	obs_data_t *settings = obs_data_create();
-	obs_data_set_string(settings, "path", file_path.c_str());
-	obs_data_set_string(settings, "format_name", "mp4");
-	obs_data_set_string(settings, "video_encoder", "h264");
-	obs_data_set_string(settings, "audio_encoder", "aac");
-	obs_output_update(output, settings);
-	obs_data_release(settings);
+	// Filtered sources hold raw frames whatever the scene buffer mode
+	for (auto &buffer_pair : get_all_source_buffers()) {
+		FrameSnapshot snapshot = buffer_pair.second->snapshot();
+		if (snapshot.video.empty())
+			continue;
+		std::string source_name = buffer_pair.first;
+		saves.emplace_back(source_name, [source_name, snapshot]() {
+			return save_frames_to_file(source_name, snapshot);
+		});
+	}
 
-	// Start output
-	if (!obs_output_start(output)) {
-		log_error("Failed to start output for scene: " + scene_name);
-		obs_output_release(output);
-		return;
+	job->total = saves.size();
+	blog(LOG_INFO, "Save job %llu queued for %zu scenes", (unsigned long long)job->id, job->total);
+
+	for (auto &save : saves) {
+		std::string scene_name = save.first;
+		std::function<bool()> run_save = std::move(save.second);
+		save_pool.submit([job, scene_name, run_save]() { report_save_progress(job, scene_name, run_save()); });
 	}
 
-	// Process frames
-	for (size_t i = 0; i < video_frames.size(); ++i) {
-		if (i < audio_frames.size() && audio_frames[i]) {
-			obs_source_output_audio(obs_get_source_by_name(REPLAY_SOURCE_NAME),
-						audio_frames[i].get());
+	if (job->total == 0)
+		report_save_completed(*job);
+
+	obs_data_set_bool(response_data, "success", true);
+	obs_data_set_int(response_data, "job_id", (long long)job->id);
+	obs_data_set_int(response_data, "scene_count", (long long)job->total);
+}
+
+// Markers keep a moment of a buffer without a blocking save: the range
+// around the mark is cut into a clip on the save pool once the history
+// after it has been captured
+static const int DEFAULT_MARKER_PRE_SECONDS = 20;
+static const int DEFAULT_MARKER_POST_SECONDS = 10;
+static std::atomic<int> marker_pre_seconds{DEFAULT_MARKER_PRE_SECONDS};
+static std::atomic<int> marker_post_seconds{DEFAULT_MARKER_POST_SECONDS};
+
+// Frames reach the ring shortly after capture, and packets after the
+// encoder's delay, so a cut waits this long past the marker's end
+static const uint64_t MARKER_SETTLE_NS = 1000000000ULL;
+
+struct ReplayMarker {
+	uint64_t id = 0;
+	std::string scene_name;
+	const char *trigger = "";
+	std::shared_ptr<FrameBuffer> buffer;
+	BufferMode mode = BufferMode::Raw;
+	uint64_t start_ns = 0; // Capture clock. A keyframe's time in encoded mode.
+	uint64_t end_ns = 0;
+	TextureFrames textures; // Pinned when nothing more will be captured
+};
+
+static std::atomic<uint64_t> next_marker_id{0};
+
+// When a packet's frame was captured, on the clock of raw frames and textures
+static uint64_t packet_capture_ns(const encoder_packet &packet)
+{
+	return (uint64_t)std::max<int64_t>(packet.sys_dts_usec, 0) * 1000;
+}
+
+static bool is_video_keyframe(const encoder_packet &packet)
+{
+	return packet.type == OBS_ENCODER_VIDEO && packet.keyframe;
+}
+
+// The keyframe nearest to `target` that is not after the mark, so the cut
+// opens a GOP and is a plain remux. `target` if the ring has none yet.
+static uint64_t find_nearest_keyframe(const std::vector<std::shared_ptr<encoder_packet>> &packets, uint64_t target,
+				      uint64_t mark)
+{
+	uint64_t nearest = target;
+	uint64_t nearest_distance = UINT64_MAX;
+	for (const auto &packet : packets) {
+		if (!is_video_keyframe(*packet))
+			continue;
+		uint64_t time = packet_capture_ns(*packet);
+		if (time > mark)
+			break;
+		uint64_t distance = time > target ? time - target : target - time;
+		if (distance < nearest_distance) {
+			nearest = time;
+			nearest_distance = distance;
 		}
-		if (video_frames[i]) {
-			obs_source_output_video(obs_get_source_by_name(REPLAY_SOURCE_NAME),
-						video_frames[i].get());
+	}
+	return nearest;
+}
+
+// Packets from the marker's keyframe up to its end
+static std::vector<std::shared_ptr<encoder_packet>>
+slice_marker_packets(const std::vector<std::shared_ptr<encoder_packet>> &packets, const ReplayMarker &marker)
+{
+	size_t begin = 0;
+	while (begin < packets.size() &&
+	       !(is_video_keyframe(*packets[begin]) && packet_capture_ns(*packets[begin]) >= marker.start_ns))
+		begin++;
+	size_t end = begin;
+	while (end < packets.size() && packet_capture_ns(*packets[end]) <= marker.end_ns)
+		end++;
+	return std::vector<std::shared_ptr<encoder_packet>>(packets.begin() + begin, packets.begin() + end);
+}
+
+// Save a marker's range as a new clip and report it
+static void cut_marker(const ReplayMarker &marker)
+{
+	const std::string &scene_name = marker.scene_name;
+	bool success = false;
+	ClipInfo clip;
+	if (marker.mode == BufferMode::Encoded) {
+		auto packets = slice_marker_packets(marker.buffer->get_packets(), marker);
+		std::shared_ptr<const PacketStreamInfo> info = std::atomic_load(&packet_stream_info);
+		if (packets.empty())
+			log_error("Marked range has left the buffer of scene: " + scene_name);
+		else
+			success = save_packets_to_file(scene_name, packets, info, &clip);
+	} else if (marker.mode == BufferMode::Texture) {
+		TextureFrames frames = marker.textures.empty() ? marker.buffer->texture_snapshot() : marker.textures;
+		FrameSnapshot snapshot;
+		snapshot.video = read_back_textures(slice_texture_frames(frames, marker.start_ns, marker.end_ns));
+		snapshot.audio = marker.buffer->snapshot().audio;
+		success = save_frames_to_file(scene_name, snapshot, &clip);
+	} else {
+		FrameSnapshot snapshot = slice_snapshot(marker.buffer->snapshot(), marker.start_ns, marker.end_ns);
+		success = save_frames_to_file(scene_name, snapshot, &clip);
+	}
+
+	obs_data_t *event_data = obs_data_create();
+	obs_data_set_int(event_data, "marker_id", (long long)marker.id);
+	obs_data_set_string(event_data, "scene", scene_name.c_str());
+	obs_data_set_string(event_data, "trigger", marker.trigger);
+	obs_data_set_bool(event_data, "success", success);
+	if (success) {
+		obs_data_set_int(event_data, "clip_id", (long long)clip.id);
+		obs_data_set_string(event_data, "file", clip.file.c_str());
+		obs_data_set_double(event_data, "duration", (double)clip.duration_ms / 1000.0);
+	}
+	emit_vendor_event("ReplayMarkerSaved", event_data);
+	obs_data_release(event_data);
+}
+
+// Holds markers until their post-roll is in, then hands each cut to the
+// save pool
+struct MarkerWorker {
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::vector<ReplayMarker> pending;
+	bool running = false;
+
+	void start() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (running)
+			return;
+		running = true;
+		worker = std::thread(&MarkerWorker::run, this);
+	}
+
+	// Markers still waiting are cut from what has been captured so far
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!running)
+				return;
+			running = false;
 		}
-		std::this_thread::sleep_for(std::chrono::milliseconds(16)); // ~60fps
+		wake.notify_all();
+		if (worker.joinable())
+			worker.join();
+
+		for (ReplayMarker &marker : pending)
+			submit(std::move(marker));
+		pending.clear();
 	}
 
-	obs_output_stop(output);
-	obs_output_release(output);
-	blog(LOG_INFO, "Saved replay for scene: %s to file: %s", scene_name.c_str(), file_path.c_str());
+	void add(ReplayMarker marker) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pending.push_back(std::move(marker));
+		}
+		wake.notify_one();
+	}
+
+	void run() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (running) {
+			uint64_t now = os_gettime_ns();
+			uint64_t next_due = UINT64_MAX;
+			for (auto it = pending.begin(); it != pending.end();) {
+				uint64_t due = it->end_ns + MARKER_SETTLE_NS;
+				if (due > now) {
+					next_due = std::min(next_due, due);
+					++it;
+					continue;
+				}
+				submit(std::move(*it));
+				it = pending.erase(it);
+			}
+
+			if (next_due == UINT64_MAX)
+				wake.wait(lock);
+			else
+				wake.wait_for(lock, std::chrono::nanoseconds(next_due - now));
+		}
+	}
+
+	static void submit(ReplayMarker marker) {
+		save_pool.submit([marker]() { cut_marker(marker); });
+	}
+};
+
+static MarkerWorker marker_worker;
+
+// The buffer a marker on `name` cuts from: a scene's, in the current mode,
+// or a filtered source's, which always holds raw frames
+static std::shared_ptr<FrameBuffer> find_marker_buffer(const std::string &name, BufferMode &mode)
+{
+	mode = buffer_mode;
+	std::shared_ptr<FrameBuffer> buffer = find_buffer(name);
+	if (buffer)
+		return buffer;
+	mode = BufferMode::Raw;
+	return find_source_buffer(name);
 }
 
-// Play Replay and Return to Previous Scene
-void play_replay_and_return(const std::string &scene_name)
+// Mark the current moment of a buffer. The clip spans `pre_seconds` before
+// to `post_seconds` after it, cut to fit the buffer's history.
+static uint64_t add_marker(const std::string &name, const std::shared_ptr<FrameBuffer> &buffer, BufferMode mode,
+			   const char *trigger, double pre_seconds, double post_seconds)
 {
-	// Save current scene
-	obs_source_t *current_scene = obs_frontend_get_current_scene();
-	if (current_scene) {
-		previous_scene_name = obs_source_get_name(current_scene);
-		obs_source_release(current_scene);
+	double history;
+	{
+		BufferMapLock lock;
+		history = (double)get_buffer_seconds(name);
 	}
+	post_seconds = std::clamp(post_seconds, 0.0, history);
+	pre_seconds = std::clamp(pre_seconds, 0.0, history - post_seconds);
+
+	ReplayMarker marker;
+	marker.id = ++next_marker_id;
+	marker.scene_name = name;
+	marker.trigger = trigger;
+	marker.buffer = buffer;
+	marker.mode = mode;
+	uint64_t mark_ns = os_gettime_ns();
+	uint64_t pre_ns = (uint64_t)(pre_seconds * 1e9);
+	marker.start_ns = mark_ns > pre_ns ? mark_ns - pre_ns : 0;
+	marker.end_ns = mark_ns + (uint64_t)(post_seconds * 1e9);
+
+	// The GOP boundary is already in the ring, so pick it now
+	if (mode == BufferMode::Encoded)
+		marker.start_ns = find_nearest_keyframe(buffer->get_packets(), marker.start_ns, mark_ns);
+	// A scene leaving program gives its textures back; keep the ones needed
+	if (mode == BufferMode::Texture && post_seconds == 0.0)
+		marker.textures = buffer->texture_snapshot();
+
+	blog(LOG_INFO, "Marker %llu on %s (%s): %.1f s before, %.1f s after", (unsigned long long)marker.id,
+	     name.c_str(), trigger, pre_seconds, post_seconds);
+	uint64_t id = marker.id;
+	marker_worker.add(std::move(marker));
+	return id;
+}
 
-	// Switch to replay scene
-	switch_to_scene(REPLAY_SCENE_NAME);
+// Mark the program scene from the hotkey
+static obs_hotkey_id mark_hotkey = OBS_INVALID_HOTKEY_ID;
 
-	// Play cached frames for the given scene
-	auto it = scene_buffers.find(scene_name);
-	if (it != scene_buffers.end()) {
-		save_frames_to_file(scene_name, it->second.get_video_frames(), it->second.get_audio_frames());
+static void on_mark_hotkey(void *data, obs_hotkey_id id, obs_hotkey_t *hotkey, bool pressed)
+{
+	UNUSED_PARAMETER(data);
+	UNUSED_PARAMETER(id);
+	UNUSED_PARAMETER(hotkey);
+	if (!pressed || !plugin_enabled)
+		return;
+
+	std::shared_ptr<const CaptureTarget> target = std::atomic_load(&capture_target);
+	if (!target || !target->buffer) {
+		log_error("No buffered scene on program to mark");
+		return;
 	}
+	add_marker(target->scene_name, target->buffer, buffer_mode, "hotkey", marker_pre_seconds, marker_post_seconds);
+}
 
-	play_cached_frames(scene_name);
+// Cut the last moments of a scene marked to clip when it leaves program.
+// Runs before the capture target moves on, while its textures are still held.
+static void mark_scene_leave(const std::shared_ptr<const CaptureTarget> &previous)
+{
+	if (!previous || !previous->buffer)
+		return;
 
-	// Switch back to previous scene
-	switch_to_scene(previous_scene_name);
+	obs_source_t *current_scene = obs_frontend_get_current_scene();
+	const char *current_name = current_scene ? obs_source_get_name(current_scene) : nullptr;
+	bool left = !current_name || previous->scene_name != current_name;
+	obs_source_release(current_scene);
+	if (!left)
+		return;
+	{
+		BufferMapLock lock;
+		if (!clip_on_leave_scenes.count(previous->scene_name))
+			return;
+	}
+	add_marker(previous->scene_name, previous->buffer, buffer_mode, "scene_leave", marker_pre_seconds, 0.0);
 }
 
-// WebSocket callback definitions
-static void on_replay_request(obs_data_t *request_data, obs_data_t *response_data, void *priv_data)
+// Mark the current moment of "scene" (the program scene by default). "pre"
+// and "post" override the default seconds kept before and after it. The
+// clip arrives with a ReplayMarkerSaved event.
+static void on_mark_replay(obs_data_t *request_data, obs_data_t *response_data, void *priv_data)
 {
 	(void)priv_data; // Mark as intentionally unused
 	const char *scene_name = obs_data_get_string(request_data, "scene");
-	if (!scene_name) {
+	std::string name = scene_name ? scene_name : "";
+	if (name.empty()) {
+		std::shared_ptr<const CaptureTarget> target = std::atomic_load(&capture_target);
+		if (target)
+			name = target->scene_name;
+	}
+
+	double pre = obs_data_has_user_value(request_data, "pre") ? obs_data_get_double(request_data, "pre")
+								  : (double)marker_pre_seconds;
+	double post = obs_data_has_user_value(request_data, "post") ? obs_data_get_double(request_data, "post")
+								    : (double)marker_post_seconds;
+
+	BufferMode mode;
+	std::shared_ptr<FrameBuffer> buffer = name.empty() ? nullptr : find_marker_buffer(name, mode);
+	const char *error = nullptr;
+	if (!plugin_enabled)
+		error = "Replay plugin is disabled";
+	else if (!buffer)
+		error = "No buffer for scene";
+	else if (!(pre >= 0.0 && post >= 0.0) || pre + post <= 0.0)
+		error = "Marker range is empty";
+	if (error) {
 		obs_data_set_bool(response_data, "success", false);
-		obs_data_set_string(response_data, "error", "No scene name provided");
+		obs_data_set_string(response_data, "error", error);
 		return;
 	}
 
-	// Ensure Replay Source and Scene are created
-	create_replay_scene_and_source();
-
-	std::thread(play_replay_and_return, std::string(scene_name)).detach();
+	uint64_t id = add_marker(name, buffer, mode, "request", pre, post);
 	obs_data_set_bool(response_data, "success", true);
+	obs_data_set_int(response_data, "marker_id", (long long)id);
+	obs_data_set_string(response_data, "scene", name.c_str());
 }
 
-static void on_save_all_replays(obs_data_t *request_data, obs_data_t *response_data, void *priv_data)
+// Default "pre" and "post" seconds of markers, and whether "scene" is
+// clipped whenever it leaves program ("on_leave")
+static void on_set_auto_clip(obs_data_t *request_data, obs_data_t *response_data, void *priv_data)
 {
-	(void)priv_data;    // Mark as intentionally unused
-	(void)request_data; // Mark as intentionally unused
+	(void)priv_data; // Mark as intentionally unused
+	long long pre = obs_data_has_user_value(request_data, "pre") ? obs_data_get_int(request_data, "pre")
+								     : marker_pre_seconds.load();
+	long long post = obs_data_has_user_value(request_data, "post") ? obs_data_get_int(request_data, "post")
+								       : marker_post_seconds.load();
+	const char *scene_name = obs_data_get_string(request_data, "scene");
+	if (pre < 0 || post < 0 || pre + post > MAX_BUFFER_SECONDS) {
+		obs_data_set_bool(response_data, "success", false);
+		obs_data_set_string(response_data, "error", "Marker range is too long");
+		return;
+	}
 
-	std::lock_guard<std::mutex> lock(buffer_mutex);
-	for (auto &buffer_pair : scene_buffers) {
-		const std::string &scene_name = buffer_pair.first;
-		auto video_frames = buffer_pair.second.get_video_frames();
-		auto audio_frames = buffer_pair.second.get_audio_frames();
-		if (!video_frames.empty() && !audio_frames.empty()) {
-			save_frames_to_file(scene_name, video_frames, audio_frames);
-		}
+	marker_pre_seconds = (int)pre;
+	marker_post_seconds = (int)post;
+	if (scene_name && *scene_name) {
+		BufferMapLock lock;
+		if (obs_data_get_bool(request_data, "on_leave"))
+			clip_on_leave_scenes.insert(scene_name);
+		else
+			clip_on_leave_scenes.erase(scene_name);
 	}
+	save_buffer_settings();
+
+	blog(LOG_INFO, "Markers keep %lld s before and %lld s after", pre, post);
 	obs_data_set_bool(response_data, "success", true);
 }
 
@@ -859,6 +4509,107 @@ void replay_plugin_open_settings(void *)
 		set_plugin_enabled(state == Qt::Checked);
 	});
 
+	QHBoxLayout *mode_layout = new QHBoxLayout();
+	QLabel *mode_label = new QLabel("Buffer Mode:", dialog);
+	QComboBox *mode_combo = new QComboBox(dialog);
+	mode_combo->addItem("Raw frames");
+	mode_combo->addItem("Encoded packets");
+	mode_combo->addItem("GPU textures");
+	mode_combo->setCurrentIndex(static_cast<int>(buffer_mode.load()));
+	mode_layout->addWidget(mode_label);
+	mode_layout->addWidget(mode_combo);
+	layout->addLayout(mode_layout);
+
+	QObject::connect(mode_combo, &QComboBox::currentIndexChanged, [=](int index) {
+		set_buffer_mode(static_cast<BufferMode>(index));
+	});
+
+	QCheckBox *preroll_checkbox = new QCheckBox("Low-latency start (save while playing)", dialog);
+	preroll_checkbox->setChecked(preroll_enabled);
+	layout->addWidget(preroll_checkbox);
+
+	QObject::connect(preroll_checkbox, &QCheckBox::stateChanged, [=](int state) {
+		set_preroll_enabled(state == Qt::Checked);
+	});
+
+	QHBoxLayout *history_layout = new QHBoxLayout();
+	QLabel *history_label = new QLabel("History:", dialog);
+	QSpinBox *history_spin = new QSpinBox(dialog);
+	history_spin->setRange(1, MAX_BUFFER_SECONDS);
+	history_spin->setSuffix(" s");
+	history_spin->setValue(default_buffer_seconds);
+	// Typed values apply once complete; "60" over 30 must not apply 6 s first
+	history_spin->setKeyboardTracking(false);
+	QLabel *budget_label = new QLabel("Memory Budget:", dialog);
+	QSpinBox *budget_spin = new QSpinBox(dialog);
+	budget_spin->setRange(256, 262144);
+	budget_spin->setSuffix(" MB");
+	budget_spin->setValue((int)memory_budget_mb.load());
+	budget_spin->setKeyboardTracking(false);
+	history_layout->addWidget(history_label);
+	history_layout->addWidget(history_spin);
+	history_layout->addWidget(budget_label);
+	history_layout->addWidget(budget_spin);
+	layout->addLayout(history_layout);
+
+	QObject::connect(history_spin, &QSpinBox::valueChanged, [=](int value) {
+		default_buffer_seconds = value;
+		save_buffer_settings();
+	});
+	QObject::connect(budget_spin, &QSpinBox::valueChanged, [=](int value) {
+		memory_budget_mb = (uint64_t)value;
+		save_buffer_settings();
+	});
+
+	QHBoxLayout *idle_layout = new QHBoxLayout();
+	QLabel *idle_label = new QLabel("Idle Scenes:", dialog);
+	QComboBox *idle_combo = new QComboBox(dialog);
+	idle_combo->addItem("Drop history");
+	idle_combo->addItem(QString("Keep last %1 s").arg(IDLE_TRIM_SECONDS));
+	idle_combo->setCurrentIndex(static_cast<int>(idle_policy.load()));
+	QLabel *idle_after_label = new QLabel("after", dialog);
+	QSpinBox *idle_spin = new QSpinBox(dialog);
+	idle_spin->setRange(0, 86400);
+	idle_spin->setSuffix(" s");
+	idle_spin->setSpecialValueText("Never");
+	idle_spin->setValue(idle_buffer_seconds);
+	idle_spin->setKeyboardTracking(false);
+	idle_layout->addWidget(idle_label);
+	idle_layout->addWidget(idle_combo);
+	idle_layout->addWidget(idle_after_label);
+	idle_layout->addWidget(idle_spin);
+	layout->addLayout(idle_layout);
+
+	QObject::connect(idle_combo, &QComboBox::currentIndexChanged, [=](int index) {
+		idle_policy = static_cast<IdlePolicy>(index);
+		save_buffer_settings();
+	});
+	QObject::connect(idle_spin, &QSpinBox::valueChanged, [=](int value) {
+		idle_buffer_seconds = value;
+		save_buffer_settings();
+	});
+
+	QHBoxLayout *spill_layout = new QHBoxLayout();
+	QCheckBox *spill_checkbox = new QCheckBox("Spill history to disk after", dialog);
+	spill_checkbox->setChecked(spill_enabled);
+	QSpinBox *spill_spin = new QSpinBox(dialog);
+	spill_spin->setRange(1, MAX_BUFFER_SECONDS);
+	spill_spin->setSuffix(" s");
+	spill_spin->setValue(spill_hot_seconds);
+	spill_spin->setKeyboardTracking(false);
+	spill_layout->addWidget(spill_checkbox);
+	spill_layout->addWidget(spill_spin);
+	layout->addLayout(spill_layout);
+
+	QObject::connect(spill_checkbox, &QCheckBox::stateChanged, [=](int state) {
+		spill_enabled = state == Qt::Checked;
+		save_buffer_settings();
+	});
+	QObject::connect(spill_spin, &QSpinBox::valueChanged, [=](int value) {
+		spill_hot_seconds = value;
+		save_buffer_settings();
+	});
+
 	QHBoxLayout *path_layout = new QHBoxLayout();
 	QLabel *path_label = new QLabel("Output Directory:", dialog);
 	QLineEdit *path_edit = new QLineEdit(dialog);
@@ -891,62 +4642,260 @@ void replay_plugin_open_settings(void *)
 	layout->addWidget(close_button);
 	QObject::connect(close_button, &QPushButton::clicked, dialog, &QDialog::accept);
 
-	dialog->exec();
-	delete dialog;
+	dialog->exec();
+	delete dialog;
+}
+
+// Re-attach to the output after a video reset (profile switch or changed
+// video settings) and pick up the new layout. Runs on the UI thread.
+static void on_video_reset()
+{
+	blog(LOG_INFO, "Video output reset; refreshing capture");
+	apply_buffer_durations(); // The frame rate may have changed
+	BufferMode mode = buffer_mode;
+	if (mode == BufferMode::Raw && video_capture_started) {
+		obs_remove_raw_video_callback(raw_video_callback, nullptr);
+		obs_add_raw_video_callback(NULL, raw_video_callback, NULL);
+	}
+
+	// Packets from before the reset may not match the new encoder's stream
+	// parameters, so encoded history starts over on the new layout
+	if (mode == BufferMode::Encoded && video_capture_started) {
+		stop_encoded_capture();
+		clear_scene_buffers();
+		update_scene_buffers();
+	}
+	profile_changing = false;
+	update_encoded_capture();
+	refresh_capture_target();
+}
+
+// libobs signals a reset from whichever thread reset the output; the
+// rebuild runs on the UI thread, never on the video thread
+static void on_video_reset_signal(void *data, calldata_t *cd)
+{
+	UNUSED_PARAMETER(data);
+	UNUSED_PARAMETER(cd);
+	obs_queue_task(OBS_TASK_UI, [](void *) { on_video_reset(); }, nullptr, false);
+}
+
+// Add this function to handle scene switches
+void on_scene_change(enum obs_frontend_event event, void *private_data)
+{
+	(void)private_data; // Suppress unused parameter warning
+
+	if (event == OBS_FRONTEND_EVENT_PROFILE_CHANGING) {
+		set_reset_hold(profile_changing, true);
+		return;
+	}
+	if (event == OBS_FRONTEND_EVENT_PROFILE_CHANGED) {
+		on_video_reset();
+		return;
+	}
+
+	// Texture slots have to go while the graphics context still exists
+	if (event == OBS_FRONTEND_EVENT_EXIT) {
+		obs_data_array_t *bindings = obs_hotkey_save(mark_hotkey);
+		obs_data_t *settings = obs_get_private_data();
+		obs_data_set_array(settings, "mark_hotkey", bindings);
+		obs_data_release(settings);
+		obs_data_array_release(bindings);
+
+		obs_remove_main_rendered_callback(texture_rendered_callback, nullptr);
+		for (ReplayPlayer &player : replay_players)
+			std::atomic_store(&player.playback, std::shared_ptr<const Playback>());
+		for (auto &buffer : get_all_buffers())
+			buffer.second->release_textures();
+		return;
+	}
+
+	if (event != OBS_FRONTEND_EVENT_SCENE_CHANGED)
+		return;
+
+	mark_scene_leave(std::atomic_load(&capture_target));
+
+	// Initializes the buffer for the new scene if it doesn't exist yet
+	refresh_capture_target();
+}
+
+// Attach the capture callbacks, once the frontend has loaded, and point
+// them at a buffer if the plugin is enabled. Buffers are created as scenes
+// go on program, so nothing is allocated here.
+static void start_capture()
+{
+	if (!plugin_fully_initialized)
+		return;
+
+	start_video_capture();
+	start_audio_capture();
+	update_scene_buffers();
+}
+
+// Cheap in both directions: the callbacks stay attached and only check the
+// flag. Enabling waits for the frontend if it is still loading, and
+// disabling hands the history to the reclaim worker. Only the encoded
+// output is stopped, so no encoder session is held while disabled.
+void set_plugin_enabled(bool enabled) {
+	if (plugin_enabled.exchange(enabled) == enabled)
+		return;
+
+	blog(LOG_INFO, "Replay Plugin %s", enabled ? "enabled" : "disabled");
+	update_encoded_capture();
+	if (enabled)
+		start_capture();
+	else
+		clear_scene_buffers();
+}
+
+// Persist the history settings and apply them to the live buffers
+static void save_buffer_settings()
+{
+	obs_data_t *settings = obs_get_private_data();
+	obs_data_set_int(settings, "buffer_seconds", default_buffer_seconds.load());
+	obs_data_set_int(settings, "memory_budget_mb", (long long)memory_budget_mb.load());
+	obs_data_set_int(settings, "idle_seconds", idle_buffer_seconds.load());
+	obs_data_set_string(settings, "idle_policy", get_idle_policy_name(idle_policy));
+	obs_data_set_bool(settings, "spill_enabled", spill_enabled);
+	obs_data_set_int(settings, "spill_hot_seconds", spill_hot_seconds.load());
+	obs_data_set_int(settings, "marker_pre_seconds", marker_pre_seconds.load());
+	obs_data_set_int(settings, "marker_post_seconds", marker_post_seconds.load());
+
+	obs_data_t *durations = obs_data_create();
+	obs_data_t *profiles = obs_data_create();
+	obs_data_t *exports = obs_data_create();
+	obs_data_array_t *clip_on_leave = obs_data_array_create();
+	{
+		BufferMapLock lock;
+		for (auto &duration : buffer_durations)
+			obs_data_set_int(durations, duration.first.c_str(), duration.second);
+		for (auto &profile : capture_profiles) {
+			obs_data_t *item = obs_data_create();
+			obs_data_set_string(item, "scale", get_capture_scale_name(profile.second.scale_divisor));
+			obs_data_set_int(item, "frame_interval", profile.second.frame_interval);
+			obs_data_set_obj(profiles, profile.first.c_str(), item);
+			obs_data_release(item);
+		}
+		for (auto &scene_name : clip_on_leave_scenes) {
+			obs_data_t *item = obs_data_create();
+			obs_data_set_string(item, "name", scene_name.c_str());
+			obs_data_array_push_back(clip_on_leave, item);
+			obs_data_release(item);
+		}
+		for (auto &shared : shared_exports)
+			obs_data_set_int(exports, shared.first.c_str(), shared.second);
+	}
+	obs_data_set_obj(settings, "buffer_durations", durations);
+	obs_data_set_obj(settings, "capture_profiles", profiles);
+	obs_data_set_obj(settings, "shared_exports", exports);
+	obs_data_set_array(settings, "clip_on_leave", clip_on_leave);
+	obs_data_release(durations);
+	obs_data_release(profiles);
+	obs_data_release(exports);
+	obs_data_array_release(clip_on_leave);
+	obs_data_release(settings);
+
+	apply_buffer_durations();
+	if (buffered_video_bytes > get_memory_budget_bytes())
+		request_memory_reclaim();
+}
+
+static void load_buffer_settings(obs_data_t *settings)
+{
+	long long seconds = obs_data_get_int(settings, "buffer_seconds");
+	if (seconds > 0)
+		default_buffer_seconds = (int)std::min<long long>(seconds, MAX_BUFFER_SECONDS);
+
+	long long budget = obs_data_get_int(settings, "memory_budget_mb");
+	if (budget > 0)
+		memory_budget_mb = (uint64_t)budget;
+
+	if (obs_data_has_user_value(settings, "idle_seconds"))
+		idle_buffer_seconds = (int)std::max<long long>(obs_data_get_int(settings, "idle_seconds"), 0);
+	const char *policy = obs_data_get_string(settings, "idle_policy");
+	if (policy && strcmp(policy, get_idle_policy_name(IdlePolicy::Trim)) == 0)
+		idle_policy = IdlePolicy::Trim;
+
+	spill_enabled = obs_data_get_bool(settings, "spill_enabled");
+	long long hot_seconds = obs_data_get_int(settings, "spill_hot_seconds");
+	if (hot_seconds > 0)
+		spill_hot_seconds = (int)std::min<long long>(hot_seconds, MAX_BUFFER_SECONDS);
+
+	if (obs_data_has_user_value(settings, "marker_pre_seconds"))
+		marker_pre_seconds = (int)std::clamp<long long>(obs_data_get_int(settings, "marker_pre_seconds"), 0,
+								MAX_BUFFER_SECONDS);
+	if (obs_data_has_user_value(settings, "marker_post_seconds"))
+		marker_post_seconds = (int)std::clamp<long long>(obs_data_get_int(settings, "marker_post_seconds"), 0,
+								 MAX_BUFFER_SECONDS);
+
+	BufferMapLock lock;
+	obs_data_t *durations = obs_data_get_obj(settings, "buffer_durations");
+	for (obs_data_item_t *item = obs_data_first(durations); item; obs_data_item_next(&item)) {
+		long long value = obs_data_item_get_int(item);
+		if (value > 0)
+			buffer_durations[obs_data_item_get_name(item)] = (int)std::min<long long>(value, MAX_BUFFER_SECONDS);
+	}
+	obs_data_release(durations);
+
+	obs_data_t *profiles = obs_data_get_obj(settings, "capture_profiles");
+	for (obs_data_item_t *item = obs_data_first(profiles); item; obs_data_item_next(&item)) {
+		obs_data_t *values = obs_data_item_get_obj(item);
+		CaptureProfile profile;
+		long long interval = obs_data_get_int(values, "frame_interval");
+		profile.frame_interval = (uint32_t)std::clamp<long long>(interval, 1, MAX_FRAME_INTERVAL);
+		if (parse_capture_scale(obs_data_get_string(values, "scale"), profile.scale_divisor) && !profile.is_full())
+			capture_profiles[obs_data_item_get_name(item)] = profile;
+		obs_data_release(values);
+	}
+	obs_data_release(profiles);
+
+	obs_data_t *exports = obs_data_get_obj(settings, "shared_exports");
+	for (obs_data_item_t *item = obs_data_first(exports); item; obs_data_item_next(&item)) {
+		long long frames = std::min<long long>(obs_data_item_get_int(item), MAX_SHARED_FRAMES);
+		if (frames > 0)
+			shared_exports[obs_data_item_get_name(item)] = (uint32_t)frames;
+	}
+	obs_data_release(exports);
+
+	obs_data_array_t *clip_on_leave = obs_data_get_array(settings, "clip_on_leave");
+	for (const std::string &scene_name : get_scene_names(clip_on_leave))
+		clip_on_leave_scenes.insert(scene_name);
+	obs_data_array_release(clip_on_leave);
 }
 
-// Add this function to handle scene switches
-void on_scene_change(enum obs_frontend_event event, void *private_data)
+// Switch between storage modes. Existing history is dropped since the modes
+// don't share a representation.
+void set_buffer_mode(BufferMode mode)
 {
-	(void)private_data; // Suppress unused parameter warning
-
-	if (event != OBS_FRONTEND_EVENT_SCENE_CHANGED)
-		return;
-
-	obs_source_t *scene = obs_frontend_get_current_scene();
-	if (!scene)
+	if (buffer_mode == mode)
 		return;
 
-	const char *scene_name = obs_source_get_name(scene);
-	std::lock_guard<std::mutex> lock(buffer_mutex);
+	blog(LOG_INFO, "Replay buffer mode set to %s", get_buffer_mode_name(mode));
 
-	// Initialize buffer for the scene if it doesn't exist
-	if (scene_buffers.find(scene_name) == scene_buffers.end()) {
-		scene_buffers[scene_name] = FrameBuffer(30, 60); // 30 seconds at 60 FPS
-		blog(LOG_INFO, "Initialized buffer for scene: %s", scene_name);
-	}
+	// Each mode attaches to a different part of the pipeline
+	bool capturing = video_capture_started;
+	stop_video_capture();
 
-	obs_source_release(scene);
-}
+	clear_scene_buffers();
+	buffer_mode = mode;
 
-// Add this function to handle plugin state changes
-void set_plugin_enabled(bool enabled) {
-	if (plugin_enabled == enabled)
-		return;
-	
-	plugin_enabled = enabled;
-	blog(LOG_INFO, "Replay Plugin %s", enabled ? "enabled" : "disabled");
+	obs_data_t *settings = obs_get_private_data();
+	obs_data_set_string(settings, "buffer_mode", get_buffer_mode_name(mode));
+	obs_data_release(settings);
 
-	if (enabled) {
-		update_scene_buffers();  // This should only create the buffers
-		start_video_capture();   // Start capture separately
-		start_audio_capture();
-	} else {
-		stop_video_capture();
-		stop_audio_capture();
-		clear_scene_buffers();
-	}
+	if (capturing)
+		start_video_capture();
+	update_scene_buffers();
 }
 
 void stop_audio_capture()
 {
+	if (!audio_capture_started)
+		return;
+
 	blog(LOG_INFO, "Stopping audio capture...");
 	
-	enumerate_sources([](obs_source_t *source) {
-		if (obs_source_get_output_flags(source) & OBS_SOURCE_AUDIO) {
-			obs_source_remove_audio_capture_callback(source, audio_callback, nullptr);
-		}
-	});
+	obs_remove_raw_audio_callback(0, mix_audio_callback, nullptr);
+	audio_capture_started = false;
 }
 
 // Plugin Initialization
@@ -961,26 +4910,31 @@ bool obs_module_load(void)
             plugin_fully_initialized = true;
             
             // Move initialization here
-            if (!create_replay_scene_and_source()) {
+            if (!replay_players[0].create_scene_and_source()) {
                 blog(LOG_ERROR, "Failed to create replay scene and source");
                 return;
             }
 
-            // Initialize scene buffers
-            update_scene_buffers();
-            
             // Start capture only after successful initialization
-            if (plugin_enabled) {
-                start_video_capture();
-                start_audio_capture();
-            }
+            start_capture();
         }
     }, nullptr);
 
+    // Keep the capture target on the program scene
+    obs_frontend_add_event_callback(on_scene_change, nullptr);
+
+    // Track scenes as they come and go rather than rescanning every source
+    connect_source_signals(true);
+    signal_handler_connect(obs_get_signal_handler(), "video_reset", on_video_reset_signal, nullptr);
+    settings_watcher = new SettingsDialogWatcher();
+    QCoreApplication::instance()->installEventFilter(settings_watcher);
+
     // Only register the source info once
     static bool source_registered = false;
     if (!source_registered) {
+        obs_register_source(&replay_filter_info);
         obs_register_source(&replay_source_info);
+        obs_register_output(&packet_output_info);
         source_registered = true;
     }
 
@@ -994,10 +4948,31 @@ bool obs_module_load(void)
 		output_directory = obs_module_config_path(NULL);
 		blog(LOG_INFO, "Using default output directory: %s", output_directory.c_str());
 	}
+	const char *saved_mode = obs_data_get_string(settings, "buffer_mode");
+	for (BufferMode mode : {BufferMode::Encoded, BufferMode::Texture}) {
+		if (saved_mode && strcmp(saved_mode, get_buffer_mode_name(mode)) == 0) {
+			buffer_mode = mode;
+			blog(LOG_INFO, "Restored %s buffer mode from settings", saved_mode);
+		}
+	}
+	load_buffer_settings(settings);
+	load_scene_groups(settings);
+	if (obs_data_has_user_value(settings, "preroll"))
+		preroll_enabled = obs_data_get_bool(settings, "preroll");
+	mark_hotkey = obs_hotkey_register_frontend("replay_plugin.mark", "Mark Replay Moment", on_mark_hotkey, nullptr);
+	obs_data_array_t *mark_bindings = obs_data_get_array(settings, "mark_hotkey");
+	obs_hotkey_load(mark_hotkey, mark_bindings);
+	obs_data_array_release(mark_bindings);
+	char *spill_path = obs_module_config_path("spill");
+	spill_directory = spill_path ? spill_path : "";
+	bfree(spill_path);
+	blog(LOG_INFO, "Replay history: %d seconds by default, %llu MB budget", default_buffer_seconds.load(),
+	     (unsigned long long)memory_budget_mb.load());
 	obs_data_release(settings);
 
 	// Register WebSocket vendor and callbacks
 	obs_websocket_vendor vendor = obs_websocket_register_vendor("replay-plugin");
+	websocket_vendor = vendor;
 	if (!vendor) {
 		blog(LOG_ERROR, "Failed to register WebSocket vendor");
 		return false;
@@ -1017,8 +4992,96 @@ bool obs_module_load(void)
 		return false;
 	}
 
+	if (!obs_websocket_vendor_register_request(
+		    vendor, "PlayReplayRange", (obs_websocket_request_callback_function)on_play_replay_range, nullptr)) {
+		blog(LOG_ERROR, "Failed to register PlayReplayRange callback");
+		return false;
+	}
+
+	if (!obs_websocket_vendor_register_request(
+		    vendor, "ReplaySequence", (obs_websocket_request_callback_function)on_replay_sequence, nullptr)) {
+		blog(LOG_ERROR, "Failed to register ReplaySequence callback");
+		return false;
+	}
+
+	if (!obs_websocket_vendor_register_request(
+		    vendor, "ListReplayClips", (obs_websocket_request_callback_function)on_list_replay_clips, nullptr)) {
+		blog(LOG_ERROR, "Failed to register ListReplayClips callback");
+		return false;
+	}
+
+	if (!obs_websocket_vendor_register_request(
+		    vendor, "PlayReplayClip", (obs_websocket_request_callback_function)on_play_replay_clip, nullptr)) {
+		blog(LOG_ERROR, "Failed to register PlayReplayClip callback");
+		return false;
+	}
+
+	if (!obs_websocket_vendor_register_request(
+		    vendor, "MarkReplay", (obs_websocket_request_callback_function)on_mark_replay, nullptr)) {
+		blog(LOG_ERROR, "Failed to register MarkReplay callback");
+		return false;
+	}
+
+	if (!obs_websocket_vendor_register_request(
+		    vendor, "SetAutoClip", (obs_websocket_request_callback_function)on_set_auto_clip, nullptr)) {
+		blog(LOG_ERROR, "Failed to register SetAutoClip callback");
+		return false;
+	}
+
+	if (!obs_websocket_vendor_register_request(
+		    vendor, "CancelReplay", (obs_websocket_request_callback_function)on_cancel_replay, nullptr)) {
+		blog(LOG_ERROR, "Failed to register CancelReplay callback");
+		return false;
+	}
+
+	if (!obs_websocket_vendor_register_request(
+		    vendor, "GetReplayStats", (obs_websocket_request_callback_function)on_get_replay_stats, nullptr)) {
+		blog(LOG_ERROR, "Failed to register GetReplayStats callback");
+		return false;
+	}
+
+	if (!obs_websocket_vendor_register_request(
+		    vendor, "SetReplayDuration", (obs_websocket_request_callback_function)on_set_replay_duration, nullptr)) {
+		blog(LOG_ERROR, "Failed to register SetReplayDuration callback");
+		return false;
+	}
+
+	if (!obs_websocket_vendor_register_request(vendor, "SetCaptureProfile",
+						   (obs_websocket_request_callback_function)on_set_capture_profile,
+						   nullptr)) {
+		blog(LOG_ERROR, "Failed to register SetCaptureProfile callback");
+		return false;
+	}
+
+	if (!obs_websocket_vendor_register_request(vendor, "SetSharedExport",
+						   (obs_websocket_request_callback_function)on_set_shared_export,
+						   nullptr)) {
+		blog(LOG_ERROR, "Failed to register SetSharedExport callback");
+		return false;
+	}
+
+	if (!obs_websocket_vendor_register_request(
+		    vendor, "SetSceneGroup", (obs_websocket_request_callback_function)on_set_scene_group, nullptr)) {
+		blog(LOG_ERROR, "Failed to register SetSceneGroup callback");
+		return false;
+	}
+
+	if (!obs_websocket_vendor_register_request(
+		    vendor, "SetActiveGroup", (obs_websocket_request_callback_function)on_set_active_group, nullptr)) {
+		blog(LOG_ERROR, "Failed to register SetActiveGroup callback");
+		return false;
+	}
+
 	blog(LOG_INFO, "WebSocket callbacks registered successfully");
 
+	log_worker.start();
+	for (size_t i = 0; i < MAX_REPLAY_PLAYERS; i++)
+		replay_players[i].start(i);
+	spill_worker.start();
+	marker_worker.start();
+	reclaim_worker.start();
+	obs_add_tick_callback(idle_tick_callback, nullptr);
+
 	// Add Tools menu items
 	obs_frontend_add_tools_menu_item("Replay Plugin Settings", replay_plugin_open_settings, nullptr);
 	obs_frontend_add_tools_menu_item("Test Replay Save All", test_save_all, nullptr);
@@ -1026,65 +5089,622 @@ bool obs_module_load(void)
 
 	blog(LOG_INFO, "Replay Plugin and Test Tools added to Tools menu.");
 
-	set_plugin_enabled(true);  // Enable the plugin by default
-
 	return true;
 }
 
 // Plugin Unload
 void obs_module_unload(void)
 {
+	for (ReplayPlayer &player : replay_players)
+		player.stop();
+	spill_worker.stop();
+	// A tick after stop() would queue onto a stopped pool
+	obs_remove_tick_callback(idle_tick_callback, nullptr);
+	obs_hotkey_unregister(mark_hotkey);
+	marker_worker.stop();
+	save_pool.stop();
 	set_plugin_enabled(false);  // Disable and clean up
+	stop_video_capture();
+	stop_audio_capture();
 
 	// Remove event callback first
 	obs_frontend_remove_event_callback(on_scene_change, nullptr);
-
-	// Clear all buffers first
+	connect_source_signals(false);
+	signal_handler_disconnect(obs_get_signal_handler(), "video_reset", on_video_reset_signal, nullptr);
+	if (QCoreApplication::instance())
+		QCoreApplication::instance()->removeEventFilter(settings_watcher);
+	delete settings_watcher;
+	settings_watcher = nullptr;
+
+	// Clear all buffers first, and wait for the detached ones to be freed
 	{
-		std::lock_guard<std::mutex> lock(buffer_mutex);
+		BufferMapLock lock;
 		scene_buffers.clear();
 	}
+	reclaim_worker.stop();
 
-	// Release the replay source properly
-	if (replay_source) {
-		// Remove from any scenes first
-		enumerate_sources([](obs_source_t *source) {
-			if (obs_source_get_type(source) == OBS_SOURCE_TYPE_SCENE) {
-				obs_scene_t *scene = obs_scene_from_source(source);
-				obs_sceneitem_t *item = obs_scene_find_source(scene, REPLAY_SOURCE_NAME);
-				if (item) {
-					obs_sceneitem_remove(item);
-				}
+	// Release the replay sources properly and remove their scenes
+	for (ReplayPlayer &player : replay_players) {
+		player.release_source(true);
+
+		obs_source_t *replay_scene = obs_get_source_by_name(player.scene_name.c_str());
+		if (replay_scene) {
+			obs_source_remove(replay_scene);
+			obs_source_release(replay_scene);
+		}
+	}
+
+	blog(LOG_INFO, "OBS Replay Plugin Unloaded");
+	log_worker.stop();
+}
+
+// One replay_capture filter. It buffers its source's frames and audio in a
+// ring of its own.
+struct ReplayFilter {
+	obs_source_t *source = nullptr;
+	obs_source_t *parent = nullptr; // Not referenced; valid from filter_add to filter_remove
+	std::shared_ptr<FrameBuffer> buffer; // Read by the capture threads with atomic_load
+};
+
+static void replay_filter_audio(void *param, obs_source_t *source, const audio_data *audio, bool muted)
+{
+	UNUSED_PARAMETER(source);
+
+	if (!plugin_enabled || muted || !audio)
+		return;
+
+	ScopedLatency latency(replay_stats.audio);
+	ReplayFilter *filter = static_cast<ReplayFilter *>(param);
+	std::shared_ptr<FrameBuffer> buffer = std::atomic_load(&filter->buffer);
+	if (buffer)
+		buffer->add_audio(audio);
+}
+
+static void *replay_filter_create(obs_data_t *settings, obs_source_t *source)
+{
+	UNUSED_PARAMETER(settings);
+
+	ReplayFilter *filter = new ReplayFilter();
+	filter->source = source;
+	return filter;
+}
+
+// Stop buffering the parent. Safe to call more than once.
+static void detach_replay_filter(ReplayFilter *filter)
+{
+	if (!filter->parent)
+		return;
+
+	// Once this returns no audio callback is still running
+	obs_source_remove_audio_capture_callback(filter->parent, replay_filter_audio, filter);
+
+	// Found by buffer, since renames re-key the map
+	{
+		BufferMapLock lock;
+		for (auto it = source_buffers.begin(); it != source_buffers.end(); ++it) {
+			if (it->second == filter->buffer) {
+				source_buffers.erase(it);
+				break;
 			}
-		});
+		}
+	}
+	std::atomic_store(&filter->buffer, std::shared_ptr<FrameBuffer>());
+
+	blog(LOG_INFO, "Replay capture stopped for source: %s", obs_source_get_name(filter->parent));
+	filter->parent = nullptr;
+}
+
+static void replay_filter_add(void *data, obs_source_t *parent)
+{
+	ReplayFilter *filter = static_cast<ReplayFilter *>(data);
+	const char *parent_name = obs_source_get_name(parent);
+
+	// Never buffer the replays themselves
+	if (!parent_name || strcmp(obs_source_get_id(parent), replay_source_info.id) == 0)
+		return;
+
+	detach_replay_filter(filter);
+
+	std::shared_ptr<FrameBuffer> buffer;
+	{
+		BufferMapLock lock;
+		buffer = make_buffer(parent_name);
+		std::shared_ptr<FrameBuffer> &entry = source_buffers[parent_name];
+		if (entry)
+			blog(LOG_WARNING, "Source %s has more than one replay capture filter; using the newest",
+			     parent_name);
+		entry = buffer;
+	}
+
+	filter->parent = parent;
+	std::atomic_store(&filter->buffer, buffer);
+	obs_source_add_audio_capture_callback(parent, replay_filter_audio, filter);
+	blog(LOG_INFO, "Replay capture started for source: %s", parent_name);
+}
+
+static void replay_filter_remove(void *data, obs_source_t *parent)
+{
+	UNUSED_PARAMETER(parent);
+	detach_replay_filter(static_cast<ReplayFilter *>(data));
+}
+
+// Async frames pass through unchanged after being copied into the ring
+static struct obs_source_frame *replay_filter_video(void *data, struct obs_source_frame *frame)
+{
+	ScopedLatency latency(replay_stats.filter_video);
+	ReplayFilter *filter = static_cast<ReplayFilter *>(data);
+	std::shared_ptr<FrameBuffer> buffer = std::atomic_load(&filter->buffer);
+	if (buffer)
+		buffer->add_source_frame(frame);
+	return frame;
+}
+
+static void replay_filter_destroy(void *data)
+{
+	ReplayFilter *filter = static_cast<ReplayFilter *>(data);
+	detach_replay_filter(filter);
+	delete filter;
+}
+
+// YUV frames are converted on the GPU from one texture per plane
+static const char *REPLAY_EFFECT = R"(
+uniform float4x4 ViewProj;
+uniform texture2d image;
+uniform texture2d plane1;
+uniform texture2d plane2;
+uniform float4x4 color_matrix;
+uniform float3 color_range_min;
+uniform float3 color_range_max;
+
+sampler_state def_sampler {
+	Filter   = Linear;
+	AddressU = Clamp;
+	AddressV = Clamp;
+};
+
+struct VertInOut {
+	float4 pos : POSITION;
+	float2 uv  : TEXCOORD0;
+};
+
+VertInOut VSDefault(VertInOut vert_in)
+{
+	VertInOut vert_out;
+	vert_out.pos = mul(float4(vert_in.pos.xyz, 1.0), ViewProj);
+	vert_out.uv  = vert_in.uv;
+	return vert_out;
+}
+
+float4 to_rgb(float3 yuv)
+{
+	yuv = clamp(yuv, color_range_min, color_range_max);
+	return float4(saturate(mul(float4(yuv, 1.0), color_matrix).rgb), 1.0);
+}
+
+float4 PSPlanar(VertInOut vert_in) : TARGET
+{
+	return to_rgb(float3(image.Sample(def_sampler, vert_in.uv).r, plane1.Sample(def_sampler, vert_in.uv).r,
+			     plane2.Sample(def_sampler, vert_in.uv).r));
+}
+
+float4 PSNV12(VertInOut vert_in) : TARGET
+{
+	return to_rgb(float3(image.Sample(def_sampler, vert_in.uv).r, plane1.Sample(def_sampler, vert_in.uv).rg));
+}
 
-		obs_source_remove(replay_source); // Mark source for removal
-		obs_source_release(replay_source);
-		replay_source = nullptr;
+technique DrawPlanar
+{
+	pass
+	{
+		vertex_shader = VSDefault(vert_in);
+		pixel_shader  = PSPlanar(vert_in);
 	}
+}
 
-	// Remove the replay scene if it exists
-	obs_source_t *replay_scene = obs_get_source_by_name(REPLAY_SCENE_NAME);
-	if (replay_scene) {
-		obs_source_remove(replay_scene);
-		obs_source_release(replay_scene);
+technique DrawNV12
+{
+	pass
+	{
+		vertex_shader = VSDefault(vert_in);
+		pixel_shader  = PSNV12(vert_in);
 	}
+}
+)";
+
+// How a frame format maps onto plane textures. Formats without a layout are
+// converted to I420 on the CPU first.
+struct PlaneLayout {
+	size_t planes = 0;
+	enum gs_color_format formats[3] = {};
+	uint32_t width_shift[3] = {};  // Log2 of the horizontal subsampling
+	uint32_t height_shift[3] = {}; // Log2 of the vertical subsampling
+	const char *technique = nullptr; // Nullptr draws RGB with the default effect
+};
 
-	blog(LOG_INFO, "OBS Replay Plugin Unloaded");
+static bool get_plane_layout(enum video_format format, PlaneLayout &layout)
+{
+	layout = PlaneLayout();
+	switch (format) {
+	case VIDEO_FORMAT_I420:
+	case VIDEO_FORMAT_I444:
+		layout.planes = 3;
+		for (size_t i = 0; i < 3; i++) {
+			layout.formats[i] = GS_R8;
+			layout.width_shift[i] = layout.height_shift[i] = (i > 0 && format == VIDEO_FORMAT_I420) ? 1 : 0;
+		}
+		layout.technique = "DrawPlanar";
+		return true;
+	case VIDEO_FORMAT_NV12:
+		layout.planes = 2;
+		layout.formats[0] = GS_R8;
+		layout.formats[1] = GS_R8G8;
+		layout.width_shift[1] = layout.height_shift[1] = 1;
+		layout.technique = "DrawNV12";
+		return true;
+	case VIDEO_FORMAT_RGBA:
+	case VIDEO_FORMAT_BGRA:
+	case VIDEO_FORMAT_BGRX:
+		layout.planes = 1;
+		layout.formats[0] = format == VIDEO_FORMAT_RGBA ? GS_RGBA : format == VIDEO_FORMAT_BGRA ? GS_BGRA : GS_BGRX;
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Plane textures for one format, reused while the frame size holds
+struct FormatTextures {
+	gs_texture_t *planes[3] = {};
+	uint32_t width = 0;
+	uint32_t height = 0;
+
+	void destroy()
+	{
+		for (gs_texture_t *&plane : planes) {
+			gs_texture_destroy(plane);
+			plane = nullptr;
+		}
+		width = height = 0;
+	}
+
+	bool prepare(const PlaneLayout &layout, uint32_t frame_width, uint32_t frame_height)
+	{
+		if (width == frame_width && height == frame_height && planes[0])
+			return true;
+
+		destroy();
+		for (size_t i = 0; i < layout.planes; i++) {
+			uint32_t plane_width = (frame_width + (1 << layout.width_shift[i]) - 1) >> layout.width_shift[i];
+			uint32_t plane_height = (frame_height + (1 << layout.height_shift[i]) - 1) >> layout.height_shift[i];
+			planes[i] = gs_texture_create(plane_width, plane_height, layout.formats[i], 1, nullptr, GS_DYNAMIC);
+			if (!planes[i]) {
+				destroy();
+				return false;
+			}
+		}
+		width = frame_width;
+		height = frame_height;
+		return true;
+	}
+};
+
+// The replay player source. Everything but `source`, `player` and `clip`
+// belongs to the graphics thread, which runs both the tick and the render.
+struct ReplaySource {
+	obs_source_t *source = nullptr;
+	ReplayPlayer *player = nullptr; // Whose playback it shows
+	obs_source_t *clip = nullptr;   // Private ffmpeg_source for encoded clips
+
+	gs_effect_t *effect = nullptr;
+	std::map<enum video_format, FormatTextures> textures;
+
+	// Frame currently in the textures
+	std::shared_ptr<const Playback> uploaded_playback;
+	size_t uploaded_frame = 0;
+	enum video_format uploaded_format = VIDEO_FORMAT_NONE;
+
+	// CPU conversion for formats the effect cannot draw
+	video_scaler_t *scaler = nullptr;
+	struct video_scale_info scaler_input = {};
+	std::vector<uint8_t> converted;
+	enum video_format unsupported_format = VIDEO_FORMAT_NONE; // Last one warned about
+
+	// Position of the tick in the playback's audio
+	std::shared_ptr<const Playback> audio_playback;
+	size_t next_audio = 0;
+};
+
+// Audio is handed to the source slightly ahead of time so it never runs
+// dry between ticks
+static const uint64_t REPLAY_AUDIO_LEAD_NS = 50000000ULL;
+
+static void replay_clip_audio(void *param, obs_source_t *clip, const audio_data *data, bool muted)
+{
+	UNUSED_PARAMETER(clip);
+
+	ReplaySource *replay = static_cast<ReplaySource *>(param);
+	const struct audio_output_info *aoi = audio_output_get_info(obs_get_audio());
+	if (muted || !data || !aoi || !replay->player->clip_playing)
+		return;
+
+	obs_source_audio audio = {};
+	for (size_t i = 0; i < MAX_AV_PLANES; i++)
+		audio.data[i] = data->data[i];
+	audio.frames = data->frames;
+	audio.speakers = aoi->speakers;
+	audio.format = AUDIO_FORMAT_FLOAT_PLANAR;
+	audio.samples_per_sec = aoi->samples_per_sec;
+	audio.timestamp = data->timestamp;
+	obs_source_output_audio(replay->source, &audio);
+}
+
+static void *replay_source_create(obs_data_t *settings, obs_source_t *source)
+{
+	long long index = obs_data_get_int(settings, "player");
+	if (index < 0 || index >= (long long)MAX_REPLAY_PLAYERS)
+		index = 0;
+
+	ReplaySource *replay = new ReplaySource();
+	replay->source = source;
+	replay->player = &replay_players[index];
+	replay->clip = obs_source_create_private("ffmpeg_source", "ReplayClip", nullptr);
+	if (replay->clip) {
+		obs_source_add_active_child(source, replay->clip);
+		obs_source_add_audio_capture_callback(replay->clip, replay_clip_audio, replay);
+	}
+	return replay;
 }
 
 static void replay_source_destroy(void *data)
 {
-	UNUSED_PARAMETER(data);
-	// Any cleanup needed when the source is destroyed
+	ReplaySource *replay = static_cast<ReplaySource *>(data);
+	if (replay->clip) {
+		obs_source_remove_audio_capture_callback(replay->clip, replay_clip_audio, replay);
+		obs_source_remove_active_child(replay->source, replay->clip);
+		obs_source_release(replay->clip);
+	}
+
+	obs_enter_graphics();
+	for (auto &format : replay->textures)
+		format.second.destroy();
+	gs_effect_destroy(replay->effect);
+	replay->uploaded_playback.reset();
+	replay->audio_playback.reset();
+	obs_leave_graphics();
+
+	if (replay->scaler)
+		video_scaler_destroy(replay->scaler);
+	delete replay;
 	blog(LOG_INFO, "Replay source destroyed");
 }
 
+static obs_source_t *replay_source_get_clip(obs_source_t *source)
+{
+	if (strcmp(obs_source_get_id(source), replay_source_info.id) != 0)
+		return nullptr;
+	ReplaySource *replay = static_cast<ReplaySource *>(obs_obj_get_data(source));
+	return replay && replay->clip ? obs_source_get_ref(replay->clip) : nullptr;
+}
+
+static void replay_source_enum_sources(void *data, obs_source_enum_proc_t enum_callback, void *param)
+{
+	ReplaySource *replay = static_cast<ReplaySource *>(data);
+	if (replay->clip)
+		enum_callback(replay->source, replay->clip, param);
+}
+
+// Push the audio of the running playback that is due by now
+static void replay_source_tick(void *data, float seconds)
+{
+	UNUSED_PARAMETER(seconds);
+
+	ReplaySource *replay = static_cast<ReplaySource *>(data);
+	std::shared_ptr<const Playback> playback = std::atomic_load(&replay->player->playback);
+	if (playback != replay->audio_playback) {
+		replay->audio_playback = playback;
+		replay->next_audio = playback && playback->speed == 1.0
+					     ? seek_timestamp(playback->audio.size(), playback->first_timestamp,
+							      [&](size_t i) { return playback->audio.timestamp(i); })
+					     : SIZE_MAX;
+	}
+	if (!playback || playback->speed != 1.0)
+		return;
+
+	const AudioView &audio_frames = playback->audio;
+	uint64_t due = std::min(playback->due_timestamp(os_gettime_ns() + REPLAY_AUDIO_LEAD_NS), playback->last_timestamp);
+	while (replay->next_audio < audio_frames.size() && audio_frames.timestamp(replay->next_audio) <= due) {
+		obs_source_audio audio = audio_frames[replay->next_audio++];
+		audio.timestamp = playback->start_time + (audio.timestamp - playback->first_timestamp);
+		obs_source_output_audio(replay->source, &audio);
+	}
+}
+
+// Frame data in a format the effect can draw, converting on the CPU if need be
+static const obs_source_frame *get_drawable_frame(ReplaySource *replay, const obs_source_frame &frame,
+						  obs_source_frame &converted)
+{
+	PlaneLayout layout;
+	if (get_plane_layout(frame.format, layout))
+		return &frame;
+
+	struct video_scale_info input = {frame.format, frame.width, frame.height,
+					 frame.full_range ? VIDEO_RANGE_FULL : VIDEO_RANGE_PARTIAL, VIDEO_CS_DEFAULT};
+	const struct video_scale_info &last = replay->scaler_input;
+	if (!replay->scaler || input.format != last.format || input.width != last.width ||
+	    input.height != last.height || input.range != last.range) {
+		if (replay->scaler)
+			video_scaler_destroy(replay->scaler);
+		replay->scaler = nullptr;
+
+		struct video_scale_info output = input;
+		output.format = VIDEO_FORMAT_I420;
+		if (video_scaler_create(&replay->scaler, &output, &input, VIDEO_SCALE_FAST_BILINEAR) !=
+		    VIDEO_SCALER_SUCCESS) {
+			if (replay->unsupported_format != frame.format)
+				blog(LOG_WARNING, "Replay source cannot draw %s frames", get_video_format_name(frame.format));
+			replay->unsupported_format = frame.format;
+			replay->scaler = nullptr;
+			return nullptr;
+		}
+		replay->scaler_input = input;
+	}
+
+	uint32_t chroma_width = (frame.width + 1) / 2;
+	uint32_t chroma_height = (frame.height + 1) / 2;
+	size_t luma_size = (size_t)frame.width * frame.height;
+	size_t chroma_size = (size_t)chroma_width * chroma_height;
+	replay->converted.resize(luma_size + chroma_size * 2);
+
+	converted = frame;
+	converted.format = VIDEO_FORMAT_I420;
+	std::memset(converted.data, 0, sizeof(converted.data));
+	std::memset(converted.linesize, 0, sizeof(converted.linesize));
+	converted.data[0] = replay->converted.data();
+	converted.data[1] = converted.data[0] + luma_size;
+	converted.data[2] = converted.data[1] + chroma_size;
+	converted.linesize[0] = frame.width;
+	converted.linesize[1] = converted.linesize[2] = chroma_width;
+	if (!video_scaler_scale(replay->scaler, converted.data, converted.linesize, frame.data, frame.linesize))
+		return nullptr;
+	return &converted;
+}
+
+// Upload a raw frame into the cached textures for its format
+static bool upload_frame(ReplaySource *replay, const obs_source_frame &frame)
+{
+	obs_source_frame converted;
+	const obs_source_frame *drawable = get_drawable_frame(replay, frame, converted);
+	PlaneLayout layout;
+	if (!drawable || !get_plane_layout(drawable->format, layout))
+		return false;
+
+	FormatTextures &textures = replay->textures[drawable->format];
+	if (!textures.prepare(layout, drawable->width, drawable->height))
+		return false;
+	for (size_t i = 0; i < layout.planes; i++)
+		gs_texture_set_image(textures.planes[i], drawable->data[i], drawable->linesize[i], false);
+	replay->uploaded_format = drawable->format;
+	return true;
+}
+
+// Frames a capture profile scaled down are stretched back to their capture size
+static void draw_raw_frame(ReplaySource *replay, const Playback &playback, const VideoSlot &slot)
+{
+	const obs_source_frame &frame = slot.frame;
+	PlaneLayout layout;
+	FormatTextures &textures = replay->textures[replay->uploaded_format];
+	if (!get_plane_layout(replay->uploaded_format, layout) || !textures.planes[0])
+		return;
+
+	if (!layout.technique) {
+		gs_effect_t *default_effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
+		gs_effect_set_texture(gs_effect_get_param_by_name(default_effect, "image"), textures.planes[0]);
+		while (gs_effect_loop(default_effect, "Draw"))
+			gs_draw_sprite(textures.planes[0], 0, slot.display_width, slot.display_height);
+		return;
+	}
+
+	if (!replay->effect) {
+		char *errors = nullptr;
+		replay->effect = gs_effect_create(REPLAY_EFFECT, "replay_source.effect", &errors);
+		if (!replay->effect) {
+			blog(LOG_ERROR, "Failed to create replay effect: %s", errors ? errors : "unknown error");
+			bfree(errors);
+			return;
+		}
+	}
+
+	// A zero matrix means the frame came from the output and has none of its own
+	const obs_source_frame &color = frame.color_matrix[15] == 0.0f ? playback.color_params : frame;
+	struct matrix4 color_matrix;
+	std::memcpy(&color_matrix, color.color_matrix, sizeof(color_matrix));
+	struct vec3 range_min, range_max;
+	vec3_set(&range_min, color.color_range_min[0], color.color_range_min[1], color.color_range_min[2]);
+	vec3_set(&range_max, color.color_range_max[0], color.color_range_max[1], color.color_range_max[2]);
+
+	const char *plane_names[3] = {"image", "plane1", "plane2"};
+	for (size_t i = 0; i < layout.planes; i++)
+		gs_effect_set_texture(gs_effect_get_param_by_name(replay->effect, plane_names[i]), textures.planes[i]);
+	gs_effect_set_matrix4(gs_effect_get_param_by_name(replay->effect, "color_matrix"), &color_matrix);
+	gs_effect_set_vec3(gs_effect_get_param_by_name(replay->effect, "color_range_min"), &range_min);
+	gs_effect_set_vec3(gs_effect_get_param_by_name(replay->effect, "color_range_max"), &range_max);
+	while (gs_effect_loop(replay->effect, layout.technique))
+		gs_draw_sprite(textures.planes[0], 0, slot.display_width, slot.display_height);
+}
+
+// Draw the frame due now. Each frame is uploaded once, however many times
+// it is drawn.
 static void replay_source_render(void *data, gs_effect_t *effect)
 {
-	UNUSED_PARAMETER(data);
 	UNUSED_PARAMETER(effect);
-	// This function is called when the source needs to be rendered
-	// For now, we'll leave it empty as we're handling rendering elsewhere
-	blog(LOG_DEBUG, "Replay source render called");
+
+	ReplaySource *replay = static_cast<ReplaySource *>(data);
+	std::shared_ptr<const Playback> playback = std::atomic_load(&replay->player->playback);
+	if (!playback) {
+		replay->uploaded_playback.reset();
+		if (replay->player->clip_playing && replay->clip)
+			obs_source_video_render(replay->clip);
+		return;
+	}
+
+	ScopedLatency latency(replay_stats.playback_render);
+	size_t index = playback->due_frame(os_gettime_ns());
+	if (!playback->textures.empty()) {
+		const TextureSlot &slot = *playback->textures[index];
+		gs_effect_t *default_effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
+		gs_effect_set_texture(gs_effect_get_param_by_name(default_effect, "image"), slot.texture);
+		while (gs_effect_loop(default_effect, "Draw"))
+			gs_draw_sprite(slot.texture, 0, slot.display_width, slot.display_height);
+		return;
+	}
+
+	const VideoSlot &slot = playback->video[index];
+	if (replay->uploaded_playback != playback || replay->uploaded_frame != index) {
+		if (!upload_frame(replay, slot.frame))
+			return;
+		replay->uploaded_playback = playback;
+		replay->uploaded_frame = index;
+	}
+	draw_raw_frame(replay, *playback, slot);
+}
+
+// Size of the frame playing, or of the output when idle so the scene item
+// keeps its bounds
+static void get_replay_source_size(ReplaySource *replay, uint32_t &width, uint32_t &height)
+{
+	std::shared_ptr<const Playback> playback = std::atomic_load(&replay->player->playback);
+	if (playback && !playback->textures.empty()) {
+		width = playback->textures.front()->display_width;
+		height = playback->textures.front()->display_height;
+		return;
+	}
+	if (playback && !playback->video.empty()) {
+		width = playback->video[0].display_width;
+		height = playback->video[0].display_height;
+		return;
+	}
+	if (replay->player->clip_playing && replay->clip && obs_source_get_width(replay->clip) > 0) {
+		width = obs_source_get_width(replay->clip);
+		height = obs_source_get_height(replay->clip);
+		return;
+	}
+
+	video_t *video = obs_get_video();
+	const struct video_output_info *voi = video ? video_output_get_info(video) : nullptr;
+	width = voi ? voi->width : 0;
+	height = voi ? voi->height : 0;
+}
+
+static uint32_t replay_source_get_width(void *data)
+{
+	uint32_t width, height;
+	get_replay_source_size(static_cast<ReplaySource *>(data), width, height);
+	return width;
+}
+
+static uint32_t replay_source_get_height(void *data)
+{
+	uint32_t width, height;
+	get_replay_source_size(static_cast<ReplaySource *>(data), width, height);
+	return height;
 }
@@ -0,0 +1,434 @@
+// Standalone benchmark of the FrameBuffer capture and eviction path. Feeds
+// synthetic frames into one buffer at a range of formats, resolutions and
+// frame rates, and reports per-frame cost, allocations and peak RSS.
+//
+//   framebuffer-benchmark [--mode raw|encoded|texture|all] [--format nv12|i420|i444|p010|yuy2|bgra]
+//                         [--resolution 1080p|1440p|2160p] [--fps 30|60|120]
+//                         [--seconds N] [--measure N] [--budget-mb N] [--padding N]
+//                         [--interval N]
+//
+// Each case first fills `--seconds` of history and two more one-second
+// segments untimed, so the numbers are for steady-state capture with eviction
+// running and slots being recycled. Then it times `--measure` seconds of
+// frames. Peak RSS is for the whole process, so it only grows from one case
+// to the next; run a single case for an isolated figure. Raw cases stay
+// within about twice `--budget-mb`; those that cannot are skipped with a
+// note of the budget they need.
+
+#include "FrameBuffer.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+std::atomic<bool> plugin_enabled{true};
+
+extern std::atomic<uint64_t> stub_allocations;
+
+// Heap allocations of any kind: libobs allocator calls plus operator new
+static std::atomic<uint64_t> new_allocations{0};
+
+void *operator new(size_t size)
+{
+	new_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *ptr = malloc(size ? size : 1))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+	free(ptr);
+}
+
+// The array forms are replaced too, so every delete frees what its own new
+// allocated instead of relying on the library's defaults to forward
+void *operator new[](size_t size)
+{
+	new_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *ptr = malloc(size ? size : 1))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void operator delete[](void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+	free(ptr);
+}
+
+static uint64_t get_allocation_count()
+{
+	return stub_allocations.load(std::memory_order_relaxed) + new_allocations.load(std::memory_order_relaxed);
+}
+
+// The plugin reclaims on a worker, from whichever buffer can spare it most;
+// here there is only the one being measured, and it is trimmed inline
+static FrameBuffer *measured_buffer = nullptr;
+
+static void request_memory_reclaim()
+{
+	while (measured_buffer && buffered_video_bytes > get_memory_budget_bytes()) {
+		if (!measured_buffer->evict_oldest_segment())
+			break;
+	}
+}
+
+// No GPU; the slot keeps whatever it held
+static void scale_texture(gs_texture_t *target, gs_texture_t *source)
+{
+	UNUSED_PARAMETER(target);
+	UNUSED_PARAMETER(source);
+}
+
+static double get_peak_rss_mb()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters = {};
+	if (!K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0.0;
+	return (double)counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+#else
+	struct rusage usage = {};
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0.0;
+#ifdef __APPLE__
+	return (double)usage.ru_maxrss / (1024.0 * 1024.0); // Bytes
+#else
+	return (double)usage.ru_maxrss / 1024.0; // Kilobytes
+#endif
+#endif
+}
+
+enum class Mode { Raw, Encoded, Texture };
+
+static const char *get_mode_name(Mode mode)
+{
+	switch (mode) {
+	case Mode::Encoded:
+		return "encoded";
+	case Mode::Texture:
+		return "texture";
+	default:
+		return "raw";
+	}
+}
+
+struct Format {
+	const char *name;
+	enum video_format format;
+};
+
+static const Format formats[] = {
+	{"nv12", VIDEO_FORMAT_NV12},
+	{"i420", VIDEO_FORMAT_I420},
+	{"i444", VIDEO_FORMAT_I444},
+	{"p010", VIDEO_FORMAT_P010},
+	{"yuy2", VIDEO_FORMAT_YUY2},
+	{"bgra", VIDEO_FORMAT_BGRA},
+};
+
+struct Resolution {
+	const char *name;
+	uint32_t width;
+	uint32_t height;
+};
+
+static const Resolution resolutions[] = {
+	{"1080p", 1920, 1080},
+	{"1440p", 2560, 1440},
+	{"2160p", 3840, 2160},
+};
+
+static const uint32_t frame_rates[] = {30, 60, 120};
+
+struct Options {
+	std::string mode = "all";
+	std::string format;
+	std::string resolution;
+	uint32_t fps = 0;
+	size_t seconds = 5;
+	size_t measure = 5;
+	uint64_t budget_mb = 2048;
+	uint32_t padding = 0; // Bytes past each packed row in raw mode
+	uint32_t interval = 1; // Capture profile frame interval
+};
+
+// Planes of one synthetic frame, filled with a fixed pattern so every run
+// copies the same bytes. `padding` widens each row past the packed size, as
+// drivers and filters with aligned strides do.
+struct SyntheticFrame {
+	std::vector<uint8_t> planes[MAX_AV_PLANES];
+	video_data data = {};
+
+	SyntheticFrame(enum video_format format, uint32_t width, uint32_t height, uint32_t padding)
+	{
+		PlaneFormat layout;
+		get_plane_format(format, layout);
+
+		uint32_t linesizes[MAX_AV_PLANES] = {};
+		uint32_t heights[MAX_AV_PLANES] = {};
+		for (size_t i = 0; i < layout.planes; i++) {
+			linesizes[i] = (uint32_t)layout.row_bytes(i, width) + padding;
+			heights[i] = layout.rows(i, height);
+		}
+
+		for (size_t i = 0; i < MAX_AV_PLANES && linesizes[i]; i++) {
+			planes[i].resize((size_t)linesizes[i] * heights[i]);
+			for (size_t b = 0; b < planes[i].size(); b++)
+				planes[i][b] = (uint8_t)(b * 31 + i * 7);
+			data.data[i] = planes[i].data();
+			data.linesize[i] = linesizes[i];
+		}
+	}
+};
+
+// Encoded mode stand-in for the replay encoders: 6000 kbps video with a
+// keyframe every second, and one 1024-sample AAC frame at 48 kHz
+struct SyntheticPackets {
+	static const int video_bitrate = 6000 * 1000 / 8;
+	static const int audio_packet_size = 160 * 1000 / 8 * 1024 / 48000;
+
+	std::vector<uint8_t> payload;
+	uint32_t fps;
+
+	explicit SyntheticPackets(uint32_t frame_rate) : fps(frame_rate)
+	{
+		payload.resize((size_t)video_bitrate / fps * 4, 0x5a); // Keyframes run larger
+	}
+
+	// The video packet of frame `index`, then any audio that falls due
+	// before the next one
+	template<typename Submit> void emit(uint64_t index, Submit &&submit)
+	{
+		int64_t dts_usec = (int64_t)(index * 1000000 / fps);
+		encoder_packet packet = {};
+		packet.type = OBS_ENCODER_VIDEO;
+		packet.keyframe = index % fps == 0;
+		packet.size = packet.keyframe ? payload.size() : payload.size() / 4;
+		packet.data = payload.data();
+		packet.dts_usec = dts_usec;
+		submit(&packet);
+
+		uint64_t audio_before = index * 48000 / 1024 / fps;
+		uint64_t audio_after = (index + 1) * 48000 / 1024 / fps;
+		for (uint64_t a = audio_before; a < audio_after; a++) {
+			encoder_packet audio = {};
+			audio.type = OBS_ENCODER_AUDIO;
+			audio.size = audio_packet_size;
+			audio.data = payload.data();
+			audio.dts_usec = (int64_t)(a * 1024 * 1000000 / 48000);
+			submit(&audio);
+		}
+	}
+};
+
+// Raw video one second of a case holds. The budget only evicts closed
+// segments, so on top of its history a case holds the open segment and the
+// spare being recycled.
+static uint64_t get_segment_bytes(const Format &format, const Resolution &resolution, uint32_t fps,
+				  uint32_t interval)
+{
+	PlaneFormat layout;
+	if (!get_plane_format(format.format, layout))
+		return 0;
+
+	uint64_t frame_bytes = 0;
+	for (size_t i = 0; i < layout.planes; i++)
+		frame_bytes += (uint64_t)layout.row_bytes(i, resolution.width) * layout.rows(i, resolution.height);
+	return frame_bytes * ((fps + interval - 1) / interval);
+}
+
+struct Result {
+	LatencyHistogram latency;
+	uint64_t frames = 0;
+	uint64_t total_ns = 0;
+	uint64_t allocations = 0;
+	size_t video_frames = 0; // Held at the end
+};
+
+// Feed `warmup` frames untimed, then time `frames` more
+template<typename Feed> static void run_frames(uint64_t warmup, uint64_t frames, Feed &&feed, Result &result)
+{
+	for (uint64_t i = 0; i < warmup; i++)
+		feed(i);
+
+	uint64_t allocations = get_allocation_count();
+	uint64_t start = os_gettime_ns();
+	for (uint64_t i = warmup; i < warmup + frames; i++) {
+		uint64_t before = os_gettime_ns();
+		feed(i);
+		result.latency.record(os_gettime_ns() - before);
+	}
+	result.total_ns = os_gettime_ns() - start;
+	result.allocations = get_allocation_count() - allocations;
+	result.frames = frames;
+}
+
+static void run_case(Mode mode, const Format &format, const Resolution &resolution, uint32_t fps,
+		     const Options &options)
+{
+	// Keep the peak to about twice the budget: a case whose two extra
+	// segments alone would pass the budget is left out
+	if (mode == Mode::Raw) {
+		uint64_t segment_mb = get_segment_bytes(format, resolution, fps, options.interval) / (1024 * 1024);
+		if (segment_mb * 2 > options.budget_mb) {
+			printf("# skipped raw %s %s %u: one second is %llu MB, needs --budget-mb %llu\n", format.name,
+			       resolution.name, fps, (unsigned long long)segment_mb, (unsigned long long)segment_mb * 2);
+			fflush(stdout);
+			return;
+		}
+	}
+
+	auto buffer = std::make_shared<FrameBuffer>(options.seconds, fps, 1);
+	CaptureProfile profile;
+	profile.frame_interval = options.interval;
+	buffer->set_profile(profile, fps, 1);
+	measured_buffer = buffer.get();
+
+	uint64_t frame_ns = 1000000000ULL / fps;
+	// Two segments past the history, so eviction has left a spare to recycle
+	uint64_t warmup = ((uint64_t)options.seconds + 2) * fps;
+	uint64_t frames = (uint64_t)options.measure * fps;
+	Result result;
+
+	if (mode == Mode::Raw) {
+		SyntheticFrame frame(format.format, resolution.width, resolution.height, options.padding);
+		run_frames(
+			warmup, frames,
+			[&](uint64_t i) {
+				frame.data.timestamp = i * frame_ns;
+				buffer->add_video_frame(&frame.data, resolution.width, resolution.height, format.format);
+			},
+			result);
+		result.video_frames = buffer->video_frame_count();
+	} else if (mode == Mode::Encoded) {
+		SyntheticPackets packets(fps);
+		run_frames(
+			warmup, frames,
+			[&](uint64_t i) { packets.emit(i, [&](encoder_packet *packet) { buffer->add_packet(packet); }); },
+			result);
+		result.video_frames = buffer->get_usage().packets;
+	} else {
+		gs_texture_t *program = gs_texture_create(resolution.width, resolution.height, GS_BGRA, 1, nullptr, 0);
+		run_frames(
+			warmup, frames, [&](uint64_t i) { buffer->add_texture_frame(program, i * frame_ns); }, result);
+		result.video_frames = buffer->get_usage().texture_frames;
+		buffer.reset(); // Slots go before the texture they were copied from
+		gs_texture_destroy(program);
+	}
+
+	measured_buffer = nullptr;
+	buffer.reset();
+
+	printf("%-8s %-5s %-6s %4u %10.0f %10.0f %10.0f %10.0f %12.3f %8zu %10.1f\n", get_mode_name(mode),
+	       mode == Mode::Raw ? format.name : "-", resolution.name, fps,
+	       result.frames ? (double)result.total_ns / result.frames : 0.0, (double)result.latency.percentile(0.50),
+	       (double)result.latency.percentile(0.99), (double)result.latency.max_ns.load(),
+	       result.frames ? (double)result.allocations / result.frames : 0.0, result.video_frames,
+	       get_peak_rss_mb());
+	fflush(stdout);
+}
+
+static bool parse_options(int argc, char **argv, Options &options)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+		if (!value) {
+			fprintf(stderr, "Missing value for %s\n", arg.c_str());
+			return false;
+		}
+		i++;
+
+		if (arg == "--mode")
+			options.mode = value;
+		else if (arg == "--format")
+			options.format = value;
+		else if (arg == "--resolution")
+			options.resolution = value;
+		else if (arg == "--fps")
+			options.fps = (uint32_t)strtoul(value, nullptr, 10);
+		else if (arg == "--seconds")
+			options.seconds = (size_t)strtoul(value, nullptr, 10);
+		else if (arg == "--measure")
+			options.measure = (size_t)strtoul(value, nullptr, 10);
+		else if (arg == "--budget-mb")
+			options.budget_mb = strtoull(value, nullptr, 10);
+		else if (arg == "--padding")
+			options.padding = (uint32_t)strtoul(value, nullptr, 10);
+		else if (arg == "--interval")
+			options.interval = (uint32_t)strtoul(value, nullptr, 10);
+		else {
+			fprintf(stderr, "Unknown option %s\n", arg.c_str());
+			return false;
+		}
+	}
+
+	if (options.seconds == 0 || options.measure == 0 || options.budget_mb == 0 || options.interval == 0) {
+		fprintf(stderr, "--seconds, --measure, --budget-mb and --interval must be positive\n");
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	if (!parse_options(argc, argv, options))
+		return 1;
+	memory_budget_mb = options.budget_mb;
+
+	printf("# history %zu s, measured %zu s, budget %llu MB; texture times exclude GPU work\n", options.seconds,
+	       options.measure, (unsigned long long)options.budget_mb);
+	printf("%-8s %-5s %-6s %4s %10s %10s %10s %10s %12s %8s %10s\n", "mode", "fmt", "res", "fps", "ns/frame",
+	       "p50_ns", "p99_ns", "max_ns", "allocs/frame", "held", "peak_rss_mb");
+
+	const Mode modes[] = {Mode::Raw, Mode::Encoded, Mode::Texture};
+	bool ran = false;
+	for (Mode mode : modes) {
+		if (options.mode != "all" && options.mode != get_mode_name(mode))
+			continue;
+		for (const Resolution &resolution : resolutions) {
+			if (!options.resolution.empty() && options.resolution != resolution.name)
+				continue;
+			for (uint32_t fps : frame_rates) {
+				if (options.fps && options.fps != fps)
+					continue;
+				for (const Format &format : formats) {
+					if (!options.format.empty() && options.format != format.name)
+						continue;
+					run_case(mode, format, resolution, fps, options);
+					ran = true;
+
+					// Only raw captures depend on the pixel format
+					if (mode != Mode::Raw)
+						break;
+				}
+			}
+		}
+	}
+
+	if (!ran) {
+		fprintf(stderr, "No benchmark case matches the given options\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,161 @@
+// Just enough of libobs for FrameBuffer.h to run outside OBS. The allocator
+// counts what it hands out, so the benchmark can report allocations per
+// frame. Graphics calls only keep the bookkeeping; no GPU work is done.
+
+#include <obs.h>
+#include <util/platform.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+std::atomic<uint64_t> stub_allocations{0};
+
+struct gs_texture {
+	uint32_t width;
+	uint32_t height;
+	enum gs_color_format format;
+};
+
+extern "C" {
+
+void *bmalloc(size_t size)
+{
+	stub_allocations.fetch_add(1, std::memory_order_relaxed);
+	return malloc(size ? size : 1);
+}
+
+void bfree(void *ptr)
+{
+	free(ptr);
+}
+
+// Warnings and errors only; the results table is the benchmark's output
+void blog(int log_level, const char *format, ...)
+{
+	if (log_level > LOG_WARNING)
+		return;
+
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fputc('\n', stderr);
+}
+
+uint64_t os_gettime_ns(void)
+{
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+int os_mkdirs(const char *path)
+{
+	std::error_code error;
+	if (std::filesystem::is_directory(path, error))
+		return MKDIR_EXISTS;
+	return std::filesystem::create_directories(path, error) ? MKDIR_SUCCESS : MKDIR_ERROR;
+}
+
+// Packet payloads are owned by the benchmark and outlive the rings, so a
+// reference is a plain copy of the header
+void obs_encoder_packet_ref(struct encoder_packet *dst, struct encoder_packet *src)
+{
+	*dst = *src;
+}
+
+void obs_encoder_packet_release(struct encoder_packet *packet)
+{
+	memset(packet, 0, sizeof(*packet));
+}
+
+void obs_enter_graphics(void) {}
+
+void obs_leave_graphics(void) {}
+
+gs_texture_t *gs_texture_create(uint32_t width, uint32_t height, enum gs_color_format color_format, uint32_t levels,
+				const uint8_t **data, uint32_t flags)
+{
+	UNUSED_PARAMETER(levels);
+	UNUSED_PARAMETER(data);
+	UNUSED_PARAMETER(flags);
+
+	stub_allocations.fetch_add(1, std::memory_order_relaxed);
+	return new gs_texture{width, height, color_format};
+}
+
+void gs_texture_destroy(gs_texture_t *tex)
+{
+	delete tex;
+}
+
+uint32_t gs_texture_get_width(const gs_texture_t *tex)
+{
+	return tex->width;
+}
+
+uint32_t gs_texture_get_height(const gs_texture_t *tex)
+{
+	return tex->height;
+}
+
+enum gs_color_format gs_texture_get_color_format(const gs_texture_t *tex)
+{
+	return tex->format;
+}
+
+void gs_copy_texture(gs_texture_t *dst, gs_texture_t *src)
+{
+	UNUSED_PARAMETER(dst);
+	UNUSED_PARAMETER(src);
+}
+
+// Capture profiles that scale fall back to full-size copies
+int video_scaler_create(video_scaler_t **scaler, const struct video_scale_info *dst,
+			const struct video_scale_info *src, enum video_scale_type type)
+{
+	UNUSED_PARAMETER(dst);
+	UNUSED_PARAMETER(src);
+	UNUSED_PARAMETER(type);
+
+	*scaler = nullptr;
+	return VIDEO_SCALER_BAD_CONVERSION;
+}
+
+void video_scaler_destroy(video_scaler_t *scaler)
+{
+	UNUSED_PARAMETER(scaler);
+}
+
+bool video_scaler_scale(video_scaler_t *scaler, uint8_t *output[], const uint32_t out_linesize[],
+			const uint8_t *const input[], const uint32_t in_linesize[])
+{
+	UNUSED_PARAMETER(scaler);
+	UNUSED_PARAMETER(output);
+	UNUSED_PARAMETER(out_linesize);
+	UNUSED_PARAMETER(input);
+	UNUSED_PARAMETER(in_linesize);
+	return false;
+}
+
+audio_t *obs_get_audio(void)
+{
+	return nullptr;
+}
+
+const struct audio_output_info *audio_output_get_info(const audio_t *audio)
+{
+	UNUSED_PARAMETER(audio);
+
+	static struct audio_output_info info = {};
+	info.samples_per_sec = 48000;
+	info.speakers = SPEAKERS_STEREO;
+	info.format = AUDIO_FORMAT_FLOAT_PLANAR;
+	return &info;
+}
+}